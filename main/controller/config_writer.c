@@ -0,0 +1,291 @@
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "peripherals/storage.h"
+#include "app_config.h"
+#include "config_writer.h"
+
+
+// Pending writes wait this long for more changes to the same keys (e.g. both serial number registers)
+#define WRITE_BACK_DELAY_MS 100
+
+#define EVENT_IDLE 0x01
+
+// Writer task notification bits: a save starts the write-back window, a flush cuts it short
+#define NOTIFY_SAVE  0x01
+#define NOTIFY_FLUSH 0x02
+
+#define KEY_SIZE 16
+
+
+typedef enum {
+    VALUE_TYPE_UINT8 = 0,
+    VALUE_TYPE_UINT16,
+    VALUE_TYPE_UINT32,
+    VALUE_TYPE_BLOB,
+} value_type_t;
+
+
+typedef struct {
+    char     key[KEY_SIZE];     // Empty for free slots
+    uint8_t  type;
+    uint8_t  len;
+    uint32_t generation;        // Changes with every write to the slot
+    uint8_t  data[CONFIG_WRITER_MAX_BLOB];
+} slot_t;
+
+
+static void    save(value_type_t type, const void *value, size_t len, const char *key);
+static void    writer_task(void *args);
+static uint8_t same_as_stored(slot_t *slot);
+static void    commit(slot_t *slot);
+
+
+static const char *TAG = "ConfigWriter";
+
+/*
+ *  Configuration writes are parked in a fixed table, one slot per key, and committed to flash by a low priority
+ *  task so that the Modbus loop never waits for an erase. A slot is freed only if it was not written again while
+ *  its value was being committed.
+ */
+static SemaphoreHandle_t          sem;
+static EventGroupHandle_t         events;
+static TaskHandle_t               task       = NULL;
+static slot_t                     slots[CONFIG_WRITER_SLOTS];
+static config_writer_statistics_t statistics = {0};
+
+
+void config_writer_init(void) {
+    static StaticSemaphore_t semaphore_buffer;
+    sem = xSemaphoreCreateMutexStatic(&semaphore_buffer);
+
+    static StaticEventGroup_t event_group_buffer;
+    events = xEventGroupCreateStatic(&event_group_buffer);
+    xEventGroupSetBits(events, EVENT_IDLE);
+
+    memset(slots, 0, sizeof(slots));
+
+    static uint8_t      stack_buffer[APP_CONFIG_BASE_TASK_STACK_SIZE * 4];
+    static StaticTask_t task_buffer;
+    task = xTaskCreateStatic(writer_task, "ConfigWriter", sizeof(stack_buffer), NULL, 1, stack_buffer, &task_buffer);
+}
+
+
+void config_writer_save_uint8(uint8_t *value, char *key) {
+    save(VALUE_TYPE_UINT8, value, sizeof(*value), key);
+}
+
+
+void config_writer_save_uint16(uint16_t *value, char *key) {
+    save(VALUE_TYPE_UINT16, value, sizeof(*value), key);
+}
+
+
+void config_writer_save_uint32(uint32_t *value, char *key) {
+    save(VALUE_TYPE_UINT32, value, sizeof(*value), key);
+}
+
+
+void config_writer_save_blob(void *value, size_t len, char *key) {
+    assert(len <= CONFIG_WRITER_MAX_BLOB);
+    save(VALUE_TYPE_BLOB, value, len, key);
+}
+
+
+/*
+ * Commits everything pending without the write-back delay; returns -1 if it did not finish within `timeout_ms`
+ */
+int config_writer_flush(uint32_t timeout_ms) {
+    xTaskNotify(task, NOTIFY_FLUSH, eSetBits);
+    EventBits_t bits = xEventGroupWaitBits(events, EVENT_IDLE, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms));
+    return (bits & EVENT_IDLE) ? 0 : -1;
+}
+
+
+void config_writer_get_statistics(config_writer_statistics_t *result) {
+    xSemaphoreTake(sem, portMAX_DELAY);
+    *result = statistics;
+    xSemaphoreGive(sem);
+}
+
+
+static void save(value_type_t type, const void *value, size_t len, const char *key) {
+    assert(strlen(key) < KEY_SIZE);
+
+    slot_t *free_slot = NULL;
+    slot_t *slot      = NULL;
+
+    xSemaphoreTake(sem, portMAX_DELAY);
+    for (size_t i = 0; i < CONFIG_WRITER_SLOTS && slot == NULL; i++) {
+        if (slots[i].key[0] == '\0') {
+            if (free_slot == NULL) {
+                free_slot = &slots[i];
+            }
+        } else if (strcmp(slots[i].key, key) == 0) {
+            slot = &slots[i];
+        }
+    }
+
+    if (slot != NULL) {
+        statistics.coalesced++;
+    } else if (free_slot != NULL) {
+        slot = free_slot;
+        strcpy(slot->key, key);
+        statistics.deferred++;
+    }
+
+    if (slot != NULL) {
+        slot->type = type;
+        slot->len  = (uint8_t)len;
+        slot->generation++;
+        memcpy(slot->data, value, len);
+        xEventGroupClearBits(events, EVENT_IDLE);
+        xSemaphoreGive(sem);
+        xTaskNotify(task, NOTIFY_SAVE, eSetBits);
+        return;
+    }
+
+    statistics.overflows++;
+    xSemaphoreGive(sem);
+
+    // Every slot is taken by another key: better late than lost
+    ESP_LOGW(TAG, "No free slot for %s, writing synchronously", key);
+    slot_t overflow = {.type = type, .len = (uint8_t)len};
+    strcpy(overflow.key, key);
+    memcpy(overflow.data, value, len);
+    commit(&overflow);
+}
+
+
+static void writer_task(void *args) {
+    (void)args;
+    slot_t copy;
+
+    for (;;) {
+        uint32_t notified = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &notified, portMAX_DELAY);
+
+        // Gather further changes for the whole window; more saves do not shorten it, only a flush does
+        TickType_t window_start = xTaskGetTickCount();
+        while ((notified & NOTIFY_FLUSH) == 0) {
+            TickType_t elapsed = xTaskGetTickCount() - window_start;
+            if (elapsed >= pdMS_TO_TICKS(WRITE_BACK_DELAY_MS)) {
+                break;
+            }
+
+            uint32_t more = 0;
+            if (xTaskNotifyWait(0, UINT32_MAX, &more, pdMS_TO_TICKS(WRITE_BACK_DELAY_MS) - elapsed) == pdTRUE) {
+                notified |= more;
+            }
+        }
+
+        // One storage session per pass: the lock is taken once and nvs_commit is called once
+        storage_begin();
+        for (size_t i = 0; i < CONFIG_WRITER_SLOTS; i++) {
+            xSemaphoreTake(sem, portMAX_DELAY);
+            copy = slots[i];
+            xSemaphoreGive(sem);
+
+            if (copy.key[0] == '\0') {
+                continue;
+            }
+
+            uint8_t skip = same_as_stored(&copy);
+            if (!skip) {
+                commit(&copy);
+            }
+
+            xSemaphoreTake(sem, portMAX_DELAY);
+            if (skip) {
+                statistics.suppressed++;
+            } else {
+                statistics.committed++;
+            }
+            if (slots[i].generation == copy.generation) {
+                slots[i].key[0] = '\0';
+            }
+            xSemaphoreGive(sem);
+        }
+        if (storage_commit()) {
+            ESP_LOGW(TAG, "Failed to commit the configuration");
+        }
+
+        xSemaphoreTake(sem, portMAX_DELAY);
+        uint8_t idle = 1;
+        for (size_t i = 0; i < CONFIG_WRITER_SLOTS; i++) {
+            if (slots[i].key[0] != '\0') {
+                idle = 0;
+            }
+        }
+        if (idle) {
+            xEventGroupSetBits(events, EVENT_IDLE);
+        } else {
+            // Rewritten while committing, go around again
+            xTaskNotify(task, NOTIFY_SAVE, eSetBits);
+        }
+        xSemaphoreGive(sem);
+    }
+
+    vTaskDelete(NULL);
+}
+
+
+/*
+ * Reading is much cheaper than an erase. Buffers start as the complement of the new value, so that a missing key
+ * (which loads successfully, leaving them untouched) never compares equal.
+ */
+static uint8_t same_as_stored(slot_t *slot) {
+    uint8_t stored[CONFIG_WRITER_MAX_BLOB + 1] __attribute__((aligned(4)));
+    for (size_t i = 0; i < slot->len; i++) {
+        stored[i] = ~slot->data[i];
+    }
+    // A longer stored blob overwrites the byte past the new value
+    stored[slot->len] = 0xFF;
+
+    int res = 0;
+    switch (slot->type) {
+        case VALUE_TYPE_UINT8:
+            res = storage_load_uint8(stored, slot->key);
+            break;
+
+        case VALUE_TYPE_UINT16:
+            res = storage_load_uint16((uint16_t *)stored, slot->key);
+            break;
+
+        case VALUE_TYPE_UINT32:
+            res = storage_load_uint32((uint32_t *)stored, slot->key);
+            break;
+
+        default:
+            res = storage_load_blob(stored, slot->len + 1, slot->key);
+            break;
+    }
+
+    return res == 0 && memcmp(stored, slot->data, slot->len) == 0 && stored[slot->len] == 0xFF;
+}
+
+
+static void commit(slot_t *slot) {
+    switch (slot->type) {
+        case VALUE_TYPE_UINT8:
+            storage_save_uint8(slot->data, slot->key);
+            break;
+
+        case VALUE_TYPE_UINT16:
+            storage_save_uint16((uint16_t *)slot->data, slot->key);
+            break;
+
+        case VALUE_TYPE_UINT32:
+            storage_save_uint32((uint32_t *)slot->data, slot->key);
+            break;
+
+        default:
+            storage_save_blob(slot->data, slot->len, slot->key);
+            break;
+    }
+}
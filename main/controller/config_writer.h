@@ -0,0 +1,32 @@
+#ifndef CONFIG_WRITER_H_INCLUDED
+#define CONFIG_WRITER_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+#define CONFIG_WRITER_SLOTS    8
+// Room for the configuration record
+#define CONFIG_WRITER_MAX_BLOB 96
+
+
+typedef struct {
+    uint32_t deferred;       // Writes handed over to the writer task
+    uint32_t coalesced;      // Writes replacing a pending one for the same key
+    uint32_t suppressed;     // Commits skipped because the stored value was the same
+    uint32_t committed;
+    uint32_t overflows;      // Writes done by the caller because every slot was busy
+} config_writer_statistics_t;
+
+
+void config_writer_init(void);
+void config_writer_save_uint8(uint8_t *value, char *key);
+void config_writer_save_uint16(uint16_t *value, char *key);
+void config_writer_save_uint32(uint32_t *value, char *key);
+void config_writer_save_blob(void *value, size_t len, char *key);
+int  config_writer_flush(uint32_t timeout_ms);
+void config_writer_get_statistics(config_writer_statistics_t *statistics);
+
+
+#endif
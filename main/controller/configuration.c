@@ -1,60 +1,232 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stddef.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "model/model.h"
 #include "peripherals/storage.h"
 #include "configuration.h"
+#include "event_log.h"
+#include "config_writer.h"
 
 
+#define CONFIGURATION_KEY     "CONFIG"
+#define CONFIGURATION_VERSION 1
+
+// Keys used before the configuration record, only read for the migration
 #define ADDRESS_KEY        "indirizzo"
 #define SERIAL_NUM_KEY     "numeroseriale"
 #define CLASS_KEY          "CLASS"
 #define SAFETY_MESSAGE_KEY "SAFETYMSG"
 
 
+/*
+ *  The whole configuration, read with a single load at boot and written with a single commit. Any layout change
+ *  must bump CONFIGURATION_VERSION; `size` is an additional guard against a truncated or foreign blob.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t version;
+    uint16_t size;
+    uint16_t address;
+    uint32_t serial_number;
+    uint16_t class;
+    char     safety_message[EASYCONNECT_MESSAGE_SIZE];
+    uint32_t baudrate;
+    uint8_t  parity;
+    uint16_t acceleration;
+    uint16_t deceleration;
+    uint8_t  ramp_profile;
+    uint8_t  speed_mode;
+    uint16_t max_rpm;
+    uint32_t crc;     // Over everything before it
+} configuration_record_t;
+
+_Static_assert(sizeof(configuration_record_t) <= CONFIG_WRITER_MAX_BLOB,
+               "The configuration record does not fit in a config writer slot");
+
+
+static int      load_record(model_t *pmodel);
+static void     migrate(model_t *pmodel);
+static void     save_record(model_t *pmodel);
+static uint32_t crc32(const void *data, size_t len);
+
+
+static const char *TAG = "Configuration";
+
+
 void configuration_init(model_t *pmodel) {
-    uint16_t value       = 0;
-    uint32_t value_32bit = 0;
+    int64_t start = esp_timer_get_time();
 
-    if (storage_load_uint16(&value, ADDRESS_KEY) == 0) {
-        model_set_address(pmodel, value);
-    }
-    if (storage_load_uint32(&value_32bit, SERIAL_NUM_KEY) == 0) {
-        model_set_serial_number(pmodel, value_32bit);
-    }
-    if (storage_load_uint16(&value, CLASS_KEY) == 0) {
-        model_set_class(pmodel, value, NULL);
+    config_writer_init();
+
+    if (load_record(pmodel)) {
+        migrate(pmodel);
     }
 
-    storage_load_blob(pmodel->safety_message, sizeof(pmodel->safety_message), SAFETY_MESSAGE_KEY);
+    ESP_LOGI(TAG, "Configuration loaded in %lluus", (unsigned long long)(esp_timer_get_time() - start));
 }
 
 
 void configuration_save_serial_number(void *args, uint32_t value) {
-    storage_save_uint32(&value, SERIAL_NUM_KEY);
     model_set_serial_number(args, value);
+    save_record(args);
+    event_log_add(EVENT_LOG_CODE_CONFIG_WRITE, EVENT_LOG_CONFIG_SERIAL_NUMBER);
 }
 
 
 void configuration_save_address(void *args, uint16_t value) {
-    storage_save_uint16(&value, ADDRESS_KEY);
     model_set_address(args, value);
+    save_record(args);
+    event_log_add(EVENT_LOG_CODE_CONFIG_WRITE, EVENT_LOG_CONFIG_ADDRESS);
 }
 
 
 void configuration_save_safety_message(void *args, const char *string) {
-    storage_save_blob((char *)string, strlen(string), SAFETY_MESSAGE_KEY);
     model_set_safety_message(args, string);
+    save_record(args);
+    event_log_add(EVENT_LOG_CODE_CONFIG_WRITE, EVENT_LOG_CONFIG_SAFETY_MESSAGE);
 }
 
 
 int configuration_save_class(void *args, uint16_t value) {
-    uint16_t corrected;
-    if (model_set_class(args, value, &corrected) == 0) {
-        storage_save_uint16(&corrected, CLASS_KEY);
+    if (model_set_class(args, value, NULL) == 0) {
+        save_record(args);
+        event_log_add(EVENT_LOG_CODE_CONFIG_WRITE, EVENT_LOG_CONFIG_CLASS);
         return 0;
     } else {
         return -1;
     }
-}
\ No newline at end of file
+}
+
+
+void configuration_save_serial(model_t *pmodel, uint32_t baudrate, uint8_t parity) {
+    model_set_baudrate(pmodel, baudrate);
+    model_set_parity(pmodel, parity);
+    save_record(pmodel);
+    event_log_add(EVENT_LOG_CODE_CONFIG_WRITE, EVENT_LOG_CONFIG_SERIAL);
+}
+
+
+void configuration_save_ramp(model_t *pmodel, uint16_t acceleration, uint16_t deceleration, uint8_t profile) {
+    model_set_acceleration(pmodel, acceleration);
+    model_set_deceleration(pmodel, deceleration);
+    model_set_ramp_profile(pmodel, profile);
+    save_record(pmodel);
+    event_log_add(EVENT_LOG_CODE_CONFIG_WRITE, EVENT_LOG_CONFIG_RAMP);
+}
+
+
+void configuration_save_speed_control(model_t *pmodel, uint8_t mode, uint16_t max_rpm) {
+    model_set_speed_mode(pmodel, mode);
+    model_set_max_rpm(pmodel, max_rpm);
+    save_record(pmodel);
+    event_log_add(EVENT_LOG_CODE_CONFIG_WRITE, EVENT_LOG_CONFIG_SPEED_CONTROL);
+}
+
+
+/*
+ * Applies the saved record to the model; returns -1 if there is none or it is not valid
+ */
+static int load_record(model_t *pmodel) {
+    configuration_record_t record = {0};
+
+    if (storage_load_blob(&record, sizeof(record), CONFIGURATION_KEY) || record.version != CONFIGURATION_VERSION) {
+        return -1;
+    }
+    if (record.size != offsetof(configuration_record_t, crc)) {
+        ESP_LOGW(TAG, "Unexpected record size %i", record.size);
+        return -1;
+    }
+    if (crc32(&record, offsetof(configuration_record_t, crc)) != record.crc) {
+        ESP_LOGW(TAG, "Corrupted configuration record");
+        return -1;
+    }
+
+    char safety_message[sizeof(record.safety_message) + 1] = {0};
+    memcpy(safety_message, record.safety_message, sizeof(record.safety_message));
+
+    model_set_address(pmodel, record.address);
+    model_set_serial_number(pmodel, record.serial_number);
+    model_set_class(pmodel, record.class, NULL);
+    model_set_safety_message(pmodel, safety_message);
+    model_set_baudrate(pmodel, record.baudrate);
+    model_set_parity(pmodel, record.parity);
+    model_set_acceleration(pmodel, record.acceleration);
+    model_set_deceleration(pmodel, record.deceleration);
+    model_set_ramp_profile(pmodel, record.ramp_profile);
+    model_set_speed_mode(pmodel, record.speed_mode);
+    model_set_max_rpm(pmodel, record.max_rpm);
+    return 0;
+}
+
+
+/*
+ * First boot after the update: whatever was saved with the old per-key layout is moved into the record. The old
+ * keys are left alone, an older firmware would still find them. Every value starts from what the model holds, the
+ * defaults at this point, and is only applied if its key was found.
+ */
+static void migrate(model_t *pmodel) {
+    uint16_t address                                      = model_get_address(pmodel);
+    uint32_t serial_number                                = model_get_serial_number(pmodel);
+    uint16_t class                                        = model_get_class(pmodel);
+    char     safety_message[EASYCONNECT_MESSAGE_SIZE + 1] = {0};
+
+    ESP_LOGI(TAG, "Migrating the configuration to a single record");
+
+    if (storage_load_uint16(&address, ADDRESS_KEY) == 0) {
+        model_set_address(pmodel, address);
+    }
+    if (storage_load_uint32(&serial_number, SERIAL_NUM_KEY) == 0) {
+        model_set_serial_number(pmodel, serial_number);
+    }
+    if (storage_load_uint16(&class, CLASS_KEY) == 0) {
+        model_set_class(pmodel, class, NULL);
+    }
+    if (storage_load_blob(safety_message, sizeof(safety_message) - 1, SAFETY_MESSAGE_KEY) == 0) {
+        model_set_safety_message(pmodel, safety_message);
+    }
+
+    save_record(pmodel);
+}
+
+
+static void save_record(model_t *pmodel) {
+    configuration_record_t record                                       = {0};
+    char                   safety_message[EASYCONNECT_MESSAGE_SIZE + 1] = {0};
+
+    model_get_safety_message(pmodel, safety_message);
+
+    record.version       = CONFIGURATION_VERSION;
+    record.size          = offsetof(configuration_record_t, crc);
+    record.address       = model_get_address(pmodel);
+    record.serial_number = model_get_serial_number(pmodel);
+    record.class         = model_get_class(pmodel);
+    memcpy(record.safety_message, safety_message, sizeof(record.safety_message));
+    record.baudrate     = model_get_baudrate(pmodel);
+    record.parity       = model_get_parity(pmodel);
+    record.acceleration = model_get_acceleration(pmodel);
+    record.deceleration = model_get_deceleration(pmodel);
+    record.ramp_profile = model_get_ramp_profile(pmodel);
+    record.speed_mode   = model_get_speed_mode(pmodel);
+    record.max_rpm      = model_get_max_rpm(pmodel);
+    record.crc          = crc32(&record, offsetof(configuration_record_t, crc));
+
+    config_writer_save_blob(&record, sizeof(record), CONFIGURATION_KEY);
+}
+
+
+// CRC-32 (IEEE 802.3), bitwise: the record is small and only checked at boot and on saves
+static uint32_t crc32(const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    uint32_t       crc   = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= bytes[i];
+        for (unsigned bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
@@ -11,6 +11,9 @@ void configuration_save_serial_number(void *args, uint32_t value);
 void configuration_save_address(void *args, uint16_t value);
 int  configuration_save_class(void *args, uint16_t value);
 void configuration_save_safety_message(void *args, const char *string);
+void configuration_save_serial(model_t *pmodel, uint32_t baudrate, uint8_t parity);
+void configuration_save_ramp(model_t *pmodel, uint16_t acceleration, uint16_t deceleration, uint8_t profile);
+void configuration_save_speed_control(model_t *pmodel, uint8_t mode, uint16_t max_rpm);
 
 
 #endif
\ No newline at end of file
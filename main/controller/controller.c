@@ -1,3 +1,7 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
 #include "esp_log.h"
 #include "controller.h"
 #include "model/model.h"
@@ -16,14 +20,58 @@
 #include "leds_activity.h"
 #include "leds_communication.h"
 #include "peripherals/heartbeat.h"
+#include "peripherals/system.h"
+#include "peripherals/digin.h"
+#include "peripherals/trip.h"
+#include "peripherals/zero_cross.h"
+#include "peripherals/tach.h"
+#include "event_log.h"
+#include "timing.h"
+#include "phase.h"
+#include "speed_control.h"
 
 
-extern volatile uint32_t calculated_phase_halfperiod;
-extern volatile uint32_t last_phase_halfperiod;
+// Notifications other than model changes: peripherals and periodic jobs
+#define CONTROLLER_EVENT_FRAME        (MODEL_CHANGE_RESERVED << 0)
+#define CONTROLLER_EVENT_INPUT        (MODEL_CHANGE_RESERVED << 1)
+#define CONTROLLER_EVENT_LEDS         (MODEL_CHANGE_RESERVED << 2)
+#define CONTROLLER_EVENT_TIMEOUTS     (MODEL_CHANGE_RESERVED << 3)
+#define CONTROLLER_EVENT_WATCHDOG     (MODEL_CHANGE_RESERVED << 4)
+#define CONTROLLER_EVENT_HOUSEKEEPING (MODEL_CHANGE_RESERVED << 5)
+#define CONTROLLER_EVENT_TRIP         (MODEL_CHANGE_RESERVED << 6)
+#define CONTROLLER_EVENT_PHASE        (MODEL_CHANGE_RESERVED << 7)
+#define CONTROLLER_EVENT_SPEED        (MODEL_CHANGE_RESERVED << 8)
+
+// Model changes that affect the motor output
+#define OUTPUT_CHANGES                                                                                                 \
+    (MODEL_CHANGE_MOTOR_ACTIVE | MODEL_CHANGE_SPEED | MODEL_CHANGE_SAFETY_BYPASS | MODEL_CHANGE_MISSING_HEARTBEAT |   \
+     MODEL_CHANGE_SPEED_CONTROL)
+
+#define LEDS_PERIOD_MS         20
+#define TIMEOUTS_PERIOD_MS     100
+#define OUTPUT_WATCHDOG_MS     500
+#define HOUSEKEEPING_PERIOD_MS 1000
+#define PHASE_PERIOD_MS        50
+
+// A synchronized output change is applied anyway if no crossing came within two half periods at 40 Hz
+#define OUTPUT_SYNC_TIMEOUT_US 25000
+
+
+typedef struct {
+    const char *name;
+    uint32_t    period_ms;
+    uint32_t    event;
+} periodic_job_t;
 
 
 static void delay_ms(unsigned long ms);
 static void console_task(void *args);
+static void update_output(model_t *pmodel);
+static void update_leds(model_t *pmodel);
+static void update_activity(void);
+static void update_phase(void);
+static void update_speed(model_t *pmodel);
+static void job_timer_callback(TimerHandle_t timer);
 
 
 static const char *TAG = "Controller";
@@ -39,42 +87,248 @@ static easyconnect_interface_t context = {
     .write_response     = rs485_write,
 };
 
+static const periodic_job_t jobs[] = {
+    {"ctrlLeds", LEDS_PERIOD_MS, CONTROLLER_EVENT_LEDS},
+    // Heartbeat and serial switch timeouts
+    {"ctrlTimeouts", TIMEOUTS_PERIOD_MS, CONTROLLER_EVENT_TIMEOUTS},
+    // Output refresh, in case some event was missed
+    {"ctrlWatchdog", OUTPUT_WATCHDOG_MS, CONTROLLER_EVENT_WATCHDOG},
+    {"ctrlHousekeep", HOUSEKEEPING_PERIOD_MS, CONTROLLER_EVENT_HOUSEKEEPING},
+    // Mains phase estimation from the zero-cross timestamps
+    {"ctrlPhase", PHASE_PERIOD_MS, CONTROLLER_EVENT_PHASE},
+    // Tachometer reading and closed loop speed control
+    {"ctrlSpeed", SPEED_CONTROL_PERIOD_MS, CONTROLLER_EVENT_SPEED},
+};
+
+static speed_pid_t  speed_pid;
+static TaskHandle_t controller_task    = NULL;
+static portMUX_TYPE activity_lock      = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t     leds_period_cycles = 0;
+
+static struct {
+    uint32_t wakeups;
+    uint64_t idle_us;
+    int64_t  since;
+    // Last completed period
+    controller_activity_t last;
+} activity = {0};
+
 
 void controller_init(model_t *pmodel) {
     context.arg = pmodel;
 
     ESP_LOGD(TAG, "Initializing controller");
+    // Restores the saved events: anything logged before would be overwritten
+    event_log_init();
     motor_init(pmodel);
     configuration_init(pmodel);
     model_check_values(pmodel);
+
     minion_init(&context);
 
+    /*
+     * A stored serial configuration goes through the same path as a change requested by the master: if no heartbeat
+     * arrives at the stored rate the node falls back to the default one, instead of staying unreachable across resets
+     */
+    uint32_t baudrate = model_get_baudrate(pmodel);
+    uint8_t  parity   = model_get_parity(pmodel);
+    if (baudrate != RS485_DEFAULT_BAUDRATE || parity != RS485_PARITY_NONE) {
+        if (minion_request_serial(baudrate, parity)) {
+            ESP_LOGW(TAG, "Invalid serial configuration, keeping the default");
+        }
+    }
+
+    // The controller runs in the calling task and sleeps until something happens
+    controller_task = xTaskGetCurrentTaskHandle();
+    model_set_observer(pmodel, controller_task);
+    rs485_set_notification(controller_task, CONTROLLER_EVENT_FRAME);
+    digin_set_notification(controller_task, CONTROLLER_EVENT_INPUT);
+    trip_set_notification(controller_task, CONTROLLER_EVENT_TRIP);
+
+    static StaticTimer_t timer_buffers[sizeof(jobs) / sizeof(jobs[0])];
+    for (size_t i = 0; i < sizeof(jobs) / sizeof(jobs[0]); i++) {
+        TimerHandle_t timer = xTimerCreateStatic(jobs[i].name, pdMS_TO_TICKS(jobs[i].period_ms), pdTRUE,
+                                                 (void *)&jobs[i], job_timer_callback, &timer_buffers[i]);
+        xTimerStart(timer, portMAX_DELAY);
+    }
+    activity.since = esp_timer_get_time();
+
+    speed_pid_init(&speed_pid, SPEED_PID_KP, SPEED_PID_KI, SPEED_PID_KD, 0, 1000);
+    timing_init();
+    leds_period_cycles = timing_us_to_cycles(LEDS_PERIOD_MS * 1000);
+
     static uint8_t      stack_buffer[APP_CONFIG_BASE_TASK_STACK_SIZE * 6];
     static StaticTask_t task_buffer;
-    xTaskCreateStatic(console_task, "Console", sizeof(stack_buffer), &context, 1, stack_buffer, &task_buffer);
+    TaskHandle_t console =
+        xTaskCreateStatic(console_task, "Console", sizeof(stack_buffer), &context, 1, stack_buffer, &task_buffer);
+    // Commands parse their arguments on the heap
+    system_heap_watch_exclude_task(console);
 }
 
 
 void controller_manage(model_t *pmodel) {
-    static unsigned long ms100_ts = 0;
+    uint32_t events = 0;
 
-    minion_manage();
+    // Changes caused by the requests handled here are notified as well, so the next pass returns immediately
+    int64_t idle_start = esp_timer_get_time();
+    xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+    activity.idle_us += esp_timer_get_time() - idle_start;
+    activity.wakeups++;
 
-    if (is_expired(ms100_ts, get_millis(), 50UL)) {
-        if ((!safety_ok() && !model_get_safety_bypass(pmodel)) || model_get_missing_heartbeat(pmodel)) {
-            motor_turn_off(pmodel);
-        } else {
-            motor_refresh(pmodel);
+    uint32_t start = timing_start();
+
+    if (events & (CONTROLLER_EVENT_FRAME | CONTROLLER_EVENT_TIMEOUTS)) {
+        minion_manage();
+    }
+
+    if (events & CONTROLLER_EVENT_PHASE) {
+        update_phase();
+    }
+
+    if (events & CONTROLLER_EVENT_SPEED) {
+        update_speed(pmodel);
+    }
+
+    if (events & (OUTPUT_CHANGES | CONTROLLER_EVENT_INPUT | CONTROLLER_EVENT_WATCHDOG | CONTROLLER_EVENT_TRIP)) {
+        update_output(pmodel);
+    }
+
+    if (events & CONTROLLER_EVENT_LEDS) {
+        static uint32_t leds_cycles = 0;
+        if (leds_cycles != 0) {
+            // How far the job drifted from its nominal period
+            uint32_t period = start - leds_cycles;
+            timing_record(TIMING_SECTION_JITTER,
+                          period > leds_period_cycles ? period - leds_period_cycles : leds_period_cycles - period);
         }
+        leds_cycles = start;
+
+        update_leds(pmodel);
+    }
+
+    if (events & CONTROLLER_EVENT_HOUSEKEEPING) {
+        size_t bytes       = 0;
+        size_t allocations = system_heap_watch_check(&bytes);
+        if (allocations > 0) {
+            ESP_LOGW(TAG, "%i heap allocations after initialization (%i bytes)", (int)allocations, (int)bytes);
+        }
+        update_activity();
+    }
+
+    timing_stop(TIMING_SECTION_CONTROLLER, start);
+}
+
 
-        ms100_ts = get_millis();
+void controller_get_activity(controller_activity_t *result) {
+    portENTER_CRITICAL(&activity_lock);
+    *result = activity.last;
+    portEXIT_CRITICAL(&activity_lock);
+}
+
+
+static void update_output(model_t *pmodel) {
+    static uint8_t safety_tripped = 0;
+
+    uint8_t bypass  = model_get_safety_bypass(pmodel);
+    uint8_t safe    = safety_ok();
+    uint8_t tripped = !safe && !bypass;
+
+    // The interrupt path has already cut the outputs; it is released only by the debounced input
+    trip_set_armed(!bypass);
+    if (tripped) {
+        trip_confirm();
+    } else if (safe) {
+        trip_rearm();
     }
 
+    if (tripped != safety_tripped) {
+        event_log_add(tripped ? EVENT_LOG_CODE_SAFETY_TRIP : EVENT_LOG_CODE_SAFETY_RESTORED, 0);
+        safety_tripped = tripped;
+    }
+
+    if (tripped || model_get_missing_heartbeat(pmodel)) {
+        motor_turn_off(pmodel);
+    } else {
+        motor_refresh(pmodel);
+    }
+}
+
+
+/*
+ * The output driver only touches the pins when the pattern changes
+ */
+static void update_leds(model_t *pmodel) {
     heartbeat_update_green(leds_communication_manage(get_millis(), !model_get_missing_heartbeat(pmodel)));
     heartbeat_update_red(leds_activity_manage(get_millis(), model_get_motor_active(pmodel), 1, safety_ok()));
 }
 
 
+static void update_activity(void) {
+    int64_t now     = esp_timer_get_time();
+    int64_t elapsed = now - activity.since;
+
+    if (elapsed > 0) {
+        portENTER_CRITICAL(&activity_lock);
+        activity.last.wakeups_per_second = (uint32_t)((activity.wakeups * 1000000ULL) / elapsed);
+        activity.last.idle_permille      = (uint16_t)((activity.idle_us * 1000ULL) / elapsed);
+        portEXIT_CRITICAL(&activity_lock);
+    }
+
+    activity.wakeups = 0;
+    activity.idle_us = 0;
+    activity.since   = now;
+}
+
+
+static void job_timer_callback(TimerHandle_t timer) {
+    const periodic_job_t *job = pvTimerGetTimerID(timer);
+    xTaskNotify(controller_task, job->event, eSetBits);
+}
+
+
+static void update_phase(void) {
+    int64_t timestamps[8];
+    size_t  count = 0;
+
+    do {
+        count = zero_cross_read(timestamps, sizeof(timestamps) / sizeof(timestamps[0]));
+        for (size_t i = 0; i < count; i++) {
+            phase_add_crossing(timestamps[i]);
+        }
+    } while (count > 0);
+
+    phase_check(esp_timer_get_time());
+    trip_flush_output(OUTPUT_SYNC_TIMEOUT_US);
+}
+
+
+static void update_speed(model_t *pmodel) {
+    static speed_tach_t tach    = {0};
+    static uint8_t      running = 0;
+
+    tach_reading_t reading = {0};
+    tach_read(&reading);
+    uint16_t rpm = speed_tach_update(&tach, reading.pulses, reading.last_edge_us, esp_timer_get_time());
+    model_set_measured_rpm(pmodel, rpm);
+
+    if (model_get_speed_mode(pmodel) == SPEED_MODE_CLOSED_LOOP && model_get_motor_active(pmodel)) {
+        uint16_t permille = model_get_speed_permille(pmodel);
+        if (!running) {
+            // Start from the duty open loop would use
+            speed_pid_reset(&speed_pid, permille, rpm);
+            running = 1;
+        }
+
+        int32_t target = ((int32_t)permille * model_get_max_rpm(pmodel)) / 1000;
+        motor_set_closed_loop_output(pmodel, (uint16_t)speed_pid_update(&speed_pid, target, rpm));
+    } else {
+        // Keeps the closed loop output on the open loop duty, for a bumpless switch
+        motor_set_closed_loop_output(pmodel, model_get_speed_permille(pmodel));
+        running = 0;
+    }
+}
+
+
 static void delay_ms(unsigned long ms) {
     vTaskDelay(pdMS_TO_TICKS(ms));
 }
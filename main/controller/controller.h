@@ -4,8 +4,15 @@
 #include "model/model.h"
 
 
+typedef struct {
+    uint32_t wakeups_per_second;
+    uint16_t idle_permille;     // Time spent waiting for events
+} controller_activity_t;
+
+
 void controller_init(model_t *model);
 void controller_manage(model_t *pmodel);
+void controller_get_activity(controller_activity_t *result);
 
 
 #endif
\ No newline at end of file
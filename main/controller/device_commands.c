@@ -7,14 +7,28 @@
 #include "argtable3/argtable3.h"
 #include "device_commands.h"
 #include "peripherals/digin.h"
+#include "peripherals/trip.h"
+#include "peripherals/outputs.h"
+#include "peripherals/zero_cross.h"
 #include "model/model.h"
 #include "configuration.h"
+#include "config_writer.h"
+#include "minion.h"
+#include "controller.h"
+#include "timing.h"
+#include "phase.h"
 #include "easyconnect_interface.h"
 
 
 static int device_commands_read_inputs(int argc, char **argv);
 static int device_commands_read_safety_message(int argc, char **argv);
 static int device_commands_set_safety_message(int argc, char **argv);
+static int device_commands_bus_stats(int argc, char **argv);
+static int device_commands_set_serial(int argc, char **argv);
+static int device_commands_activity(int argc, char **argv);
+static int device_commands_stats(int argc, char **argv);
+static int device_commands_outputs(int argc, char **argv);
+static int device_commands_config_writer(int argc, char **argv);
 
 
 static model_t *model_ref = NULL;
@@ -46,6 +60,54 @@ void device_commands_register(model_t *pmodel) {
         .func    = &device_commands_set_safety_message,
     };
     ESP_ERROR_CHECK(esp_console_cmd_register(&set_safety_message));
+
+    const esp_console_cmd_t bus_stats = {
+        .command = "BusStats",
+        .help    = "Print Modbus bus statistics and diagnostic counters",
+        .hint    = NULL,
+        .func    = &device_commands_bus_stats,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&bus_stats));
+
+    const esp_console_cmd_t set_serial = {
+        .command = "SetSerial",
+        .help    = "Set the Modbus baud rate and parity (0 none, 1 even, 2 odd)",
+        .hint    = NULL,
+        .func    = &device_commands_set_serial,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&set_serial));
+
+    const esp_console_cmd_t activity = {
+        .command = "Activity",
+        .help    = "Print controller wakeups per second and idle time over the last second",
+        .hint    = NULL,
+        .func    = &device_commands_activity,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&activity));
+
+    const esp_console_cmd_t stats = {
+        .command = "Stats",
+        .help    = "Print the execution time histograms of the control loop sections",
+        .hint    = NULL,
+        .func    = &device_commands_stats,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&stats));
+
+    const esp_console_cmd_t outputs = {
+        .command = "Outputs",
+        .help    = "Print how many output writes reached the hardware and how many were suppressed",
+        .hint    = NULL,
+        .func    = &device_commands_outputs,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&outputs));
+
+    const esp_console_cmd_t config_writer = {
+        .command = "ConfigWriter",
+        .help    = "Print the configuration writer counters",
+        .hint    = NULL,
+        .func    = &device_commands_config_writer,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&config_writer));
 }
 
 static int device_commands_read_inputs(int argc, char **argv) {
@@ -59,6 +121,24 @@ static int device_commands_read_inputs(int argc, char **argv) {
     if (nerrors == 0) {
         uint8_t value = (uint8_t)digin_get_inputs();
         printf("Safety=%i\n", (value & 0x01) > 0);
+
+        trip_statistics_t trip = {0};
+        trip_get_statistics(&trip);
+        printf("Trip latched=%i count=%lu\n", trip_is_latched(), (unsigned long)trip.count);
+        printf("Trip handler to output cut last=%luns max=%luns, debounce confirmation %lums\n",
+               (unsigned long)trip.last_handler_ns, (unsigned long)trip.max_handler_ns,
+               (unsigned long)trip.last_confirm_ms);
+
+        printf("Fan %lu rpm, %s loop\n", (unsigned long)model_get_measured_rpm(model_ref),
+               model_get_speed_mode(model_ref) == SPEED_MODE_CLOSED_LOOP ? "closed" : "open");
+
+        phase_statistics_t phase = {0};
+        phase_get_statistics(&phase);
+        printf("Phase locked=%i half period=%luus (last %luus) jitter=%luus max=%luus\n", phase.locked,
+               (unsigned long)phase.halfperiod_us, (unsigned long)last_phase_halfperiod,
+               (unsigned long)phase.jitter_us, (unsigned long)phase.max_jitter_us);
+        printf("Phase rejected=%lu missed=%lu overruns=%lu\n", (unsigned long)phase.rejected,
+               (unsigned long)phase.missed, (unsigned long)zero_cross_get_overruns());
     } else {
         arg_print_errors(stdout, end, "Read device inputs");
     }
@@ -106,3 +186,194 @@ static int device_commands_set_safety_message(int argc, char **argv) {
     return nerrors ? -1 : 0;
 }
 
+
+static int device_commands_bus_stats(int argc, char **argv) {
+    const char *diagnostic_names[MINION_DIAGNOSTIC_NUM] = {
+        [MINION_DIAGNOSTIC_BUS_MESSAGES]       = "Bus messages",
+        [MINION_DIAGNOSTIC_CRC_ERRORS]         = "CRC errors",
+        [MINION_DIAGNOSTIC_EXCEPTIONS]         = "Exceptions",
+        [MINION_DIAGNOSTIC_SERVER_MESSAGES]    = "Server messages",
+        [MINION_DIAGNOSTIC_SERVER_NO_RESPONSE] = "Server no response",
+        [MINION_DIAGNOSTIC_OVERRUNS]           = "Overruns",
+        [MINION_DIAGNOSTIC_SKIPPED_FRAMES]     = "Skipped frames",
+        [MINION_DIAGNOSTIC_RECOVERED_FRAMES]   = "Recovered frames",
+    };
+
+    struct arg_lit *clear;
+    struct arg_end *end;
+    void           *argtable[] = {
+        clear = arg_lit0("c", "clear", "reset the counters"),
+        end   = arg_end(1),
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+    if (nerrors == 0) {
+        if (clear->count > 0) {
+            minion_clear_diagnostics();
+        }
+
+        for (size_t i = 0; i < MINION_DIAGNOSTIC_NUM; i++) {
+            printf("%s=%lu\n", diagnostic_names[i], (unsigned long)minion_get_diagnostic(i));
+        }
+
+        printf("Serial=%lu baud, parity %i\n", (unsigned long)model_get_baudrate(model_ref), model_get_parity(model_ref));
+
+        minion_turnaround_t turnaround = {0};
+        minion_get_turnaround(&turnaround);
+        printf("Responses=%lu\n", (unsigned long)turnaround.count);
+        printf("Turnaround last=%luus avg=%luus p99<=%luus max=%luus\n", (unsigned long)turnaround.last,
+               (unsigned long)(turnaround.count > 0 ? turnaround.total / turnaround.count : 0),
+               (unsigned long)minion_turnaround_percentile(&turnaround, 990), (unsigned long)turnaround.max);
+        if (turnaround.count > 0) {
+            printf("First response=%llums after reset\n", (unsigned long long)(turnaround.first_response / 1000));
+        }
+    } else {
+        arg_print_errors(stdout, end, "Bus statistics");
+    }
+
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return nerrors ? -1 : 0;
+}
+
+
+static int device_commands_set_serial(int argc, char **argv) {
+    struct arg_int *baudrate;
+    struct arg_int *parity;
+    struct arg_end *end;
+    void           *argtable[] = {
+        baudrate = arg_int1(NULL, NULL, "<baud rate>", "baud rate"),
+        parity   = arg_int0(NULL, NULL, "<parity>", "parity"),
+        end      = arg_end(1),
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+    if (nerrors == 0) {
+        uint8_t value = parity->count > 0 ? parity->ival[0] : 0;
+        if (minion_request_serial(baudrate->ival[0], value)) {
+            printf("Invalid serial configuration\n");
+            nerrors = 1;
+        }
+    } else {
+        arg_print_errors(stdout, end, "Set serial");
+    }
+
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return nerrors ? -1 : 0;
+}
+
+
+static int device_commands_activity(int argc, char **argv) {
+    struct arg_end *end;
+    void           *argtable[] = {
+        end = arg_end(1),
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+    if (nerrors == 0) {
+        controller_activity_t activity = {0};
+        controller_get_activity(&activity);
+        printf("Wakeups=%lu/s\n", (unsigned long)activity.wakeups_per_second);
+        printf("Idle=%i.%i%%\n", activity.idle_permille / 10, activity.idle_permille % 10);
+    } else {
+        arg_print_errors(stdout, end, "Activity");
+    }
+
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return nerrors ? -1 : 0;
+}
+
+
+static int device_commands_stats(int argc, char **argv) {
+    struct arg_lit *reset;
+    struct arg_end *end;
+    void           *argtable[] = {
+        reset = arg_lit0("r", "reset", "reset the statistics"),
+        end   = arg_end(1),
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+    if (nerrors == 0) {
+        for (size_t i = 0; i < TIMING_SECTION_NUM; i++) {
+            timing_stats_t stats = {0};
+            timing_get(i, &stats);
+
+            printf("%s count=%lu avg=%luus max=%luus misses=%lu\n", timing_section_name(i), (unsigned long)stats.count,
+                   (unsigned long)(stats.count > 0 ? timing_cycles_to_us((uint32_t)(stats.total / stats.count)) : 0),
+                   (unsigned long)timing_cycles_to_us(stats.max), (unsigned long)stats.misses);
+
+            for (size_t j = 0; j < TIMING_BUCKETS; j++) {
+                if (stats.buckets[j] > 0) {
+                    printf("  >=%lu cycles: %lu\n", 1UL << j, (unsigned long)stats.buckets[j]);
+                }
+            }
+        }
+
+        if (reset->count > 0) {
+            timing_reset();
+        }
+    } else {
+        arg_print_errors(stdout, end, "Stats");
+    }
+
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return nerrors ? -1 : 0;
+}
+
+
+static int device_commands_outputs(int argc, char **argv) {
+    struct arg_lit *reset;
+    struct arg_end *end;
+    void           *argtable[] = {
+        reset = arg_lit0("r", "reset", "reset the counters"),
+        end   = arg_end(1),
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+    if (nerrors == 0) {
+        for (size_t i = 0; i < OUTPUT_NUM; i++) {
+            outputs_statistics_t statistics = {0};
+            outputs_get_statistics(i, &statistics);
+            printf("%s written=%lu suppressed=%lu\n", outputs_name(i), (unsigned long)statistics.written,
+                   (unsigned long)statistics.suppressed);
+        }
+
+        if (reset->count > 0) {
+            outputs_reset_statistics();
+        }
+    } else {
+        arg_print_errors(stdout, end, "Outputs");
+    }
+
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return nerrors ? -1 : 0;
+}
+
+
+static int device_commands_config_writer(int argc, char **argv) {
+    struct arg_lit *flush;
+    struct arg_end *end;
+    void           *argtable[] = {
+        flush = arg_lit0("f", "flush", "commit pending writes first"),
+        end   = arg_end(1),
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+    if (nerrors == 0) {
+        if (flush->count > 0 && config_writer_flush(1000)) {
+            printf("Flush timed out\n");
+        }
+
+        config_writer_statistics_t statistics = {0};
+        config_writer_get_statistics(&statistics);
+        printf("Deferred=%lu\n", (unsigned long)statistics.deferred);
+        printf("Coalesced=%lu\n", (unsigned long)statistics.coalesced);
+        printf("Suppressed=%lu\n", (unsigned long)statistics.suppressed);
+        printf("Committed=%lu\n", (unsigned long)statistics.committed);
+        printf("Overflows=%lu\n", (unsigned long)statistics.overflows);
+    } else {
+        arg_print_errors(stdout, end, "ConfigWriter");
+    }
+
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return nerrors ? -1 : 0;
+}
@@ -0,0 +1,141 @@
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "peripherals/storage.h"
+#include "app_config.h"
+#include "event_log.h"
+
+
+#define EVENT_LOG_KEY             "EVENTLOG"
+#define EVENT_LOG_FLUSH_BATCH     8
+#define EVENT_LOG_FLUSH_PERIOD_MS 60000UL
+
+
+typedef struct {
+    uint32_t          head;
+    event_log_entry_t entries[EVENT_LOG_SIZE];
+} event_log_blob_t;
+
+
+static void flush_task(void *args);
+static void copy_entries(event_log_blob_t *blob, uint32_t head);
+
+
+static const char *TAG = "EventLog";
+
+/*
+ * Every writer reserves its own slot by advancing `head`; the slot sequence number is cleared while the entry is
+ * being filled and published last, so that readers can tell complete entries from the ones in progress.
+ */
+static event_log_entry_t entries[EVENT_LOG_SIZE] = {0};
+static uint32_t          head                    = 0;
+static uint32_t          flushed                 = 0;
+static TaskHandle_t      flush_task_handle       = NULL;
+// Only used during initialization and by the flush task
+static event_log_blob_t blob = {0};
+
+
+void event_log_init(void) {
+    if (storage_load_blob(&blob, sizeof(blob), EVENT_LOG_KEY) == 0) {
+        for (size_t i = 0; i < EVENT_LOG_SIZE; i++) {
+            // Discard anything that does not belong to the saved window
+            uint32_t sequence = blob.entries[i].sequence;
+            if (sequence > 0 && sequence <= blob.head && sequence + EVENT_LOG_SIZE > blob.head &&
+                (sequence - 1) % EVENT_LOG_SIZE == i) {
+                entries[i] = blob.entries[i];
+            }
+        }
+        head    = blob.head;
+        flushed = blob.head;
+    }
+    ESP_LOGI(TAG, "Restored %i events", (int)head);
+
+    static uint8_t      stack_buffer[APP_CONFIG_BASE_TASK_STACK_SIZE * 4];
+    static StaticTask_t task_buffer;
+    flush_task_handle =
+        xTaskCreateStatic(flush_task, "EventLog", sizeof(stack_buffer), NULL, 1, stack_buffer, &task_buffer);
+}
+
+
+/*
+ * Appends an event; never blocks and can be called from any task
+ */
+void event_log_add(event_log_code_t code, uint16_t data) {
+    uint32_t           index = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    event_log_entry_t *entry = &entries[index % EVENT_LOG_SIZE];
+
+    __atomic_store_n(&entry->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    entry->timestamp = (uint32_t)time(NULL);
+    entry->code      = code;
+    entry->data      = data;
+    __atomic_store_n(&entry->sequence, index + 1, __ATOMIC_RELEASE);
+
+    if (flush_task_handle != NULL && index + 1 - __atomic_load_n(&flushed, __ATOMIC_RELAXED) == EVENT_LOG_FLUSH_BATCH) {
+        xTaskNotifyGive(flush_task_handle);
+    }
+}
+
+
+uint32_t event_log_count(void) {
+    return __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * Copies the event at `index` (counting from 0 since the log was created). Returns -1 if the event was
+ * overwritten, is being written or does not exist yet.
+ */
+int event_log_get(uint32_t index, event_log_entry_t *entry) {
+    const event_log_entry_t *slot     = &entries[index % EVENT_LOG_SIZE];
+    uint32_t                 sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+    if (sequence != index + 1) {
+        return -1;
+    }
+
+    entry->sequence  = sequence;
+    entry->timestamp = slot->timestamp;
+    entry->code      = slot->code;
+    entry->data      = slot->data;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence ? 0 : -1;
+}
+
+
+static void flush_task(void *args) {
+    (void)args;
+
+    for (;;) {
+        // Woken up by a full batch, otherwise whatever is pending gets saved periodically
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(EVENT_LOG_FLUSH_PERIOD_MS));
+
+        uint32_t current = event_log_count();
+        if (current != __atomic_load_n(&flushed, __ATOMIC_RELAXED)) {
+            copy_entries(&blob, current);
+            storage_save_blob(&blob, sizeof(blob), EVENT_LOG_KEY);
+            __atomic_store_n(&flushed, current, __ATOMIC_RELAXED);
+            ESP_LOGD(TAG, "Saved %i events", (int)current);
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+
+static void copy_entries(event_log_blob_t *blob, uint32_t head) {
+    memset(blob, 0, sizeof(*blob));
+    blob->head = head;
+
+    uint32_t first = head > EVENT_LOG_SIZE ? head - EVENT_LOG_SIZE : 0;
+    for (uint32_t index = first; index < head; index++) {
+        event_log_entry_t *entry = &blob->entries[index % EVENT_LOG_SIZE];
+        // Entries still being written are skipped and saved with the following batch
+        if (event_log_get(index, entry)) {
+            memset(entry, 0, sizeof(*entry));
+        }
+    }
+}
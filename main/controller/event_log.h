@@ -0,0 +1,48 @@
+#ifndef EVENT_LOG_H_INCLUDED
+#define EVENT_LOG_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+#define EVENT_LOG_SIZE 64
+
+
+typedef enum {
+    EVENT_LOG_CODE_NONE = 0,
+    EVENT_LOG_CODE_RESET,              // data: reset reason
+    EVENT_LOG_CODE_SAFETY_TRIP,
+    EVENT_LOG_CODE_SAFETY_RESTORED,
+    EVENT_LOG_CODE_HEARTBEAT_LOST,
+    EVENT_LOG_CODE_MOTOR_ON,           // data: speed percentage
+    EVENT_LOG_CODE_MOTOR_OFF,
+    EVENT_LOG_CODE_CONFIG_WRITE,       // data: event_log_config_t
+} event_log_code_t;
+
+
+typedef enum {
+    EVENT_LOG_CONFIG_ADDRESS = 0,
+    EVENT_LOG_CONFIG_SERIAL_NUMBER,
+    EVENT_LOG_CONFIG_CLASS,
+    EVENT_LOG_CONFIG_SAFETY_MESSAGE,
+    EVENT_LOG_CONFIG_SERIAL,
+    EVENT_LOG_CONFIG_RAMP,
+    EVENT_LOG_CONFIG_SPEED_CONTROL,
+} event_log_config_t;
+
+
+typedef struct {
+    uint32_t sequence;      // Position in the log starting from 1, 0 for empty entries
+    uint32_t timestamp;     // Unix time, as set by the master
+    uint16_t code;
+    uint16_t data;
+} event_log_entry_t;
+
+
+void     event_log_init(void);
+void     event_log_add(event_log_code_t code, uint16_t data);
+uint32_t event_log_count(void);
+int      event_log_get(uint32_t index, event_log_entry_t *entry);
+
+
+#endif
@@ -0,0 +1,30 @@
+#include "linearization.h"
+#include "sine_linearization.h"
+
+
+/*
+ * Duty (out of `duty_max`) delivering `permille` of the power of a sine half wave: the phase delay from the
+ * generated table is interpolated linearly between its points, in Q16. Kept free of any dependency so that
+ * tools/check_linearization.py can compare it against the table generator on the host.
+ */
+uint32_t linearization_duty(uint16_t permille, uint32_t duty_max) {
+    if (permille == 0) {
+        return 0;
+    } else if (permille >= 1000) {
+        return duty_max;
+    }
+
+    uint32_t position = (uint32_t)((((uint64_t)permille * SINE_PERCENTAGE_LINEARIZATION_PIECES) << 16) / 1000);
+    uint32_t index    = position >> 16;
+    uint32_t fraction = position & 0xFFFF;
+
+    int32_t from  = sine_percentage_linearization[index];
+    int32_t to    = sine_percentage_linearization[index + 1];
+    // Rounded: flooring a decreasing segment would bias the delay down by up to one unit
+    int32_t delay = from + (int32_t)(((int64_t)(to - from) * fraction + 0x8000) >> 16);
+
+    // The output is on for the rest of the half wave
+    return (uint32_t)(((uint64_t)(SINE_PERCENTAGE_LINEARIZATION_MAXIMUM - delay) * duty_max +
+                       SINE_PERCENTAGE_LINEARIZATION_MAXIMUM / 2) /
+                      SINE_PERCENTAGE_LINEARIZATION_MAXIMUM);
+}
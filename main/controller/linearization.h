@@ -0,0 +1,11 @@
+#ifndef LINEARIZATION_H_INCLUDED
+#define LINEARIZATION_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+uint32_t linearization_duty(uint16_t permille, uint32_t duty_max);
+
+
+#endif
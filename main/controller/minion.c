@@ -5,6 +5,7 @@
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "freertos/projdefs.h"
 #include "peripherals/hardwareprofile.h"
 #include "lightmodbus/base.h"
@@ -22,6 +23,9 @@
 #include "easyconnect.h"
 #include "motor.h"
 #include "model/model.h"
+#include "configuration.h"
+#include "event_log.h"
+#include "timing.h"
 #include "app_config.h"
 
 
@@ -31,19 +35,189 @@
 
 #define COIL_MOTOR_STATE   0
 #define COIL_SAFETY_BYPASS 1
+#define COIL_TIMING_RESET  2
+// Closed loop rpm control instead of open loop duty
+#define COIL_SPEED_CLOSED_LOOP 3
+
+// Device specific function codes, in the Modbus user defined range
+#define FUNCTION_CODE_SET_FAN_STATE       100
+#define FUNCTION_CODE_SET_CLASS_FAN_STATE 101
+#define FUNCTION_CODE_SET_SERIAL          102
+
+#define FUNCTION_CODE_DIAGNOSTICS 8
+
+// FC08 sub-functions
+#define DIAGNOSTICS_RETURN_QUERY_DATA             0x00
+#define DIAGNOSTICS_CLEAR_COUNTERS                0x0A
+#define DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT      0x0B
+#define DIAGNOSTICS_RETURN_BUS_ERROR_COUNT        0x0C
+#define DIAGNOSTICS_RETURN_EXCEPTION_COUNT        0x0D
+#define DIAGNOSTICS_RETURN_SERVER_MESSAGE_COUNT   0x0E
+#define DIAGNOSTICS_RETURN_SERVER_NO_RESPONSE     0x0F
+#define DIAGNOSTICS_RETURN_CHARACTER_OVERRUNS     0x12
+#define DIAGNOSTICS_CLEAR_OVERRUN_COUNTER         0x14
+
+#define HOLDING_REGISTER_DIAGNOSTICS  (HOLDING_REGISTER_SPEED + 1)
+#define HOLDING_REGISTER_LOGS_CURSOR  (HOLDING_REGISTER_DIAGNOSTICS + MINION_DIAGNOSTIC_NUM)
+#define HOLDING_REGISTER_TIMING       (HOLDING_REGISTER_LOGS_CURSOR + 1)
+#define HOLDING_REGISTER_ACCELERATION (HOLDING_REGISTER_TIMING + TIMING_SECTION_NUM * TIMING_REGISTERS)
+#define HOLDING_REGISTER_DECELERATION (HOLDING_REGISTER_ACCELERATION + 1)
+#define HOLDING_REGISTER_RAMP_PROFILE (HOLDING_REGISTER_DECELERATION + 1)
+// Current and target duty, out of 8192
+#define HOLDING_REGISTER_DUTY           (HOLDING_REGISTER_RAMP_PROFILE + 1)
+#define HOLDING_REGISTER_SPEED_PERMILLE (HOLDING_REGISTER_DUTY + 2)
+#define HOLDING_REGISTER_RPM            (HOLDING_REGISTER_SPEED_PERMILLE + 1)
+// Speed in closed loop at 100%
+#define HOLDING_REGISTER_MAX_RPM (HOLDING_REGISTER_RPM + 1)
+
+// Each event occupies sequence, timestamp (high and low word), code and data in the logs window
+#define LOG_ENTRY_REGISTERS 5
+// Each timing section shows count, average (us), maximum (us), budget misses and the histogram buckets
+#define TIMING_REGISTERS (4 + TIMING_BUCKETS)
+
+// Largest response the slave can build: a full PDU plus RTU address and CRC
+#define RESPONSE_BUFFER_SIZE (MODBUS_PDU_MAX + MODBUS_RTU_ADU_PADDING)
+
+/*
+ *  Register map. Each entry lists name, first and last address, access rights, accepted write range and the
+ *  read/write handlers; the descriptor tables and the address lookup tables are all generated from here.
+ */
+#define HOLDING_REGISTERS(X)                                                                                           \
+    X(ADDRESS, EASYCONNECT_HOLDING_REGISTER_ADDRESS, EASYCONNECT_HOLDING_REGISTER_ADDRESS, RW, 1, 255, read_address,  \
+      write_address)                                                                                                   \
+    X(FIRMWARE_VERSION, EASYCONNECT_HOLDING_REGISTER_FIRMWARE_VERSION, EASYCONNECT_HOLDING_REGISTER_FIRMWARE_VERSION,  \
+      R, 0, 0, read_firmware_version, NULL)                                                                            \
+    X(CLASS, EASYCONNECT_HOLDING_REGISTER_CLASS, EASYCONNECT_HOLDING_REGISTER_CLASS, RW, 0, 0xFFFF, read_class,        \
+      write_class)                                                                                                     \
+    X(SERIAL_NUMBER_1, EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_1, EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_1, RW, \
+      0, 0xFFFF, read_serial_number_1, write_serial_number_1)                                                          \
+    X(SERIAL_NUMBER_2, EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_2, EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_2, RW, \
+      0, 0xFFFF, read_serial_number_2, write_serial_number_2)                                                          \
+    X(ALARMS, EASYCONNECT_HOLDING_REGISTER_ALARMS, EASYCONNECT_HOLDING_REGISTER_ALARMS, R, 0, 0, read_alarms, NULL)    \
+    X(STATE, EASYCONNECT_HOLDING_REGISTER_STATE, EASYCONNECT_HOLDING_REGISTER_STATE, R, 0, 0, read_state, NULL)        \
+    X(LOGS_COUNTER, EASYCONNECT_HOLDING_REGISTER_LOGS_COUNTER, EASYCONNECT_HOLDING_REGISTER_LOGS_COUNTER, R, 0, 0,     \
+      read_logs_counter, NULL)                                                                                         \
+    X(LOGS, EASYCONNECT_HOLDING_REGISTER_LOGS, EASYCONNECT_HOLDING_REGISTER_MESSAGE_1 - 1, R, 0, 0, read_logs, NULL)   \
+    X(SAFETY_MESSAGE, HOLDING_REGISTER_SAFETY_MESSAGE, HOLDING_REGISTER_FEEDBACK_MESSAGE - 1, RW, 0, 0xFFFF,           \
+      read_safety_message, write_safety_message)                                                                       \
+    X(SPEED, HOLDING_REGISTER_SPEED, HOLDING_REGISTER_SPEED, RW, 0, 100, read_speed, write_speed)                     \
+    X(DIAGNOSTICS, HOLDING_REGISTER_DIAGNOSTICS, HOLDING_REGISTER_DIAGNOSTICS + MINION_DIAGNOSTIC_NUM - 1, R, 0, 0,    \
+      read_diagnostics, NULL)                                                                                          \
+    X(LOGS_CURSOR, HOLDING_REGISTER_LOGS_CURSOR, HOLDING_REGISTER_LOGS_CURSOR, RW, 0, 0xFFFF, read_logs_cursor,        \
+      write_logs_cursor)                                                                                               \
+    X(TIMING, HOLDING_REGISTER_TIMING, HOLDING_REGISTER_TIMING + TIMING_SECTION_NUM * TIMING_REGISTERS - 1, R, 0, 0,   \
+      read_timing, NULL)                                                                                               \
+    X(ACCELERATION, HOLDING_REGISTER_ACCELERATION, HOLDING_REGISTER_ACCELERATION, RW, 0, MAX_RAMP_RATE,                \
+      read_acceleration, write_acceleration)                                                                           \
+    X(DECELERATION, HOLDING_REGISTER_DECELERATION, HOLDING_REGISTER_DECELERATION, RW, 0, MAX_RAMP_RATE,                \
+      read_deceleration, write_deceleration)                                                                           \
+    X(RAMP_PROFILE, HOLDING_REGISTER_RAMP_PROFILE, HOLDING_REGISTER_RAMP_PROFILE, RW, RAMP_PROFILE_LINEAR,             \
+      RAMP_PROFILE_S_CURVE, read_ramp_profile, write_ramp_profile)                                                     \
+    X(DUTY, HOLDING_REGISTER_DUTY, HOLDING_REGISTER_DUTY + 1, R, 0, 0, read_duty, NULL)                               \
+    X(SPEED_PERMILLE, HOLDING_REGISTER_SPEED_PERMILLE, HOLDING_REGISTER_SPEED_PERMILLE, RW, 0, 1000,                   \
+      read_speed_permille, write_speed_permille)                                                                       \
+    X(RPM, HOLDING_REGISTER_RPM, HOLDING_REGISTER_RPM, R, 0, 0, read_rpm, NULL)                                        \
+    X(MAX_RPM, HOLDING_REGISTER_MAX_RPM, HOLDING_REGISTER_MAX_RPM, RW, MIN_MAX_RPM, MAX_MAX_RPM, read_max_rpm,         \
+      write_max_rpm)
+
+#define COILS(X)                                                                                                       \
+    X(MOTOR_STATE, COIL_MOTOR_STATE, COIL_MOTOR_STATE, RW, 0, 1, read_motor_state, write_motor_state)                  \
+    X(SAFETY_BYPASS, COIL_SAFETY_BYPASS, COIL_SAFETY_BYPASS, RW, 0, 1, read_safety_bypass, write_safety_bypass)       \
+    X(TIMING_RESET, COIL_TIMING_RESET, COIL_TIMING_RESET, RW, 0, 1, read_timing_reset, write_timing_reset)             \
+    X(SPEED_CLOSED_LOOP, COIL_SPEED_CLOSED_LOOP, COIL_SPEED_CLOSED_LOOP, RW, 0, 1, read_speed_closed_loop,             \
+      write_speed_closed_loop)
+
+#define REGISTER_ID(name, first, last, access, min, max, read, write)  REGISTER_ID_##name,
+#define REGISTER_MAP(name, first, last, access, min, max, read, write) [(first) ... (last)] = REGISTER_ID_##name,
+#define REGISTER_ENTRY(name, first, last, access, min, max, read, write)                                               \
+    [REGISTER_ID_##name] = {(first), REGISTER_ACCESS_##access, (min), (max), (read), (write)},
+
+
+typedef enum {
+    REGISTER_ACCESS_R  = 0x01,
+    REGISTER_ACCESS_W  = 0x02,
+    REGISTER_ACCESS_RW = REGISTER_ACCESS_R | REGISTER_ACCESS_W,
+} register_access_t;
+
+typedef struct {
+    uint16_t first;
+    uint8_t  access;
+    uint16_t min;
+    uint16_t max;
+    uint16_t (*read)(const model_snapshot_t *snapshot, uint16_t offset);
+    void (*write)(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+} register_descriptor_t;
+
+// 0 is reserved for unmapped addresses in the lookup tables
+enum { REGISTER_ID_NONE = 0, HOLDING_REGISTERS(REGISTER_ID) COILS(REGISTER_ID) };
 
 
 static ModbusError           register_callback(const ModbusSlave *status, const ModbusRegisterCallbackArgs *args,
                                                ModbusRegisterCallbackResult *result);
 static ModbusError           exception_callback(const ModbusSlave *minion, uint8_t function, ModbusExceptionCode code);
+static ModbusError           response_allocator(ModbusBuffer *buffer, uint16_t size, void *context);
 static LIGHTMODBUS_RET_ERROR initialization_function(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
                                                      uint8_t requestLength);
 static LIGHTMODBUS_RET_ERROR set_class_output(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
                                               uint8_t requestLength);
+static LIGHTMODBUS_RET_ERROR diagnostics_function(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                                  uint8_t requestLength);
+static LIGHTMODBUS_RET_ERROR set_fan_state(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                           uint8_t requestLength);
+static LIGHTMODBUS_RET_ERROR set_class_fan_state(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                                 uint8_t requestLength);
+static LIGHTMODBUS_RET_ERROR set_serial(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                        uint8_t requestLength);
 static LIGHTMODBUS_RET_ERROR heartbeat_received(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
                                                 uint8_t requestLength);
 static LIGHTMODBUS_RET_ERROR set_datetime(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
                                           uint8_t requestLength);
+static void                  update_turnaround(int64_t request, int64_t response);
+static void                  manage_serial_switch(easyconnect_interface_t *context);
+static void                  apply_staged_message(easyconnect_interface_t *context);
+static uint8_t               is_addressed_to_us(const uint8_t *frame, int len, uint16_t address);
+static const register_descriptor_t *lookup_register(const uint8_t *map, size_t map_size, uint16_t index);
+static uint16_t read_address(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_address(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_firmware_version(const model_snapshot_t *snapshot, uint16_t offset);
+static uint16_t read_class(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_class(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_serial_number_1(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_serial_number_1(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_serial_number_2(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_serial_number_2(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_alarms(const model_snapshot_t *snapshot, uint16_t offset);
+static uint16_t read_state(const model_snapshot_t *snapshot, uint16_t offset);
+static uint16_t read_logs_counter(const model_snapshot_t *snapshot, uint16_t offset);
+static uint16_t read_logs(const model_snapshot_t *snapshot, uint16_t offset);
+static uint16_t read_safety_message(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_safety_message(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_speed(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_speed(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_diagnostics(const model_snapshot_t *snapshot, uint16_t offset);
+static uint16_t read_logs_cursor(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_logs_cursor(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_timing(const model_snapshot_t *snapshot, uint16_t offset);
+static uint16_t read_acceleration(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_acceleration(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_deceleration(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_deceleration(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_ramp_profile(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_ramp_profile(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_duty(const model_snapshot_t *snapshot, uint16_t offset);
+static uint16_t read_speed_permille(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_speed_permille(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_rpm(const model_snapshot_t *snapshot, uint16_t offset);
+static uint16_t read_max_rpm(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_max_rpm(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_motor_state(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_motor_state(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_safety_bypass(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_safety_bypass(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_timing_reset(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_timing_reset(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
+static uint16_t read_speed_closed_loop(const model_snapshot_t *snapshot, uint16_t offset);
+static void     write_speed_closed_loop(easyconnect_interface_t *context, uint16_t offset, uint16_t value);
 
 
 static const ModbusSlaveFunctionHandler custom_functions[] = {
@@ -65,6 +239,7 @@ static const ModbusSlaveFunctionHandler custom_functions[] = {
 #if defined(LIGHTMODBUS_F06S) || defined(LIGHTMODBUS_SLAVE_FULL)
     {6, modbusParseRequest0506},
 #endif
+    {FUNCTION_CODE_DIAGNOSTICS, diagnostics_function},
 #if defined(LIGHTMODBUS_F15S) || defined(LIGHTMODBUS_SLAVE_FULL)
     {15, modbusParseRequest1516},
 #endif
@@ -79,6 +254,9 @@ static const ModbusSlaveFunctionHandler custom_functions[] = {
     {EASYCONNECT_FUNCTION_CODE_RANDOM_SERIAL_NUMBER, easyconnect_send_address_function},
     {EASYCONNECT_FUNCTION_CODE_NETWORK_INITIALIZATION, initialization_function},
     {EASYCONNECT_FUNCTION_CODE_SET_CLASS_OUTPUT, set_class_output},
+    {FUNCTION_CODE_SET_FAN_STATE, set_fan_state},
+    {FUNCTION_CODE_SET_CLASS_FAN_STATE, set_class_fan_state},
+    {FUNCTION_CODE_SET_SERIAL, set_serial},
     {EASYCONNECT_FUNCTION_CODE_SET_TIME, set_datetime},
     {EASYCONNECT_FUNCTION_CODE_HEARTBEAT, heartbeat_received},
 
@@ -86,9 +264,38 @@ static const ModbusSlaveFunctionHandler custom_functions[] = {
     {0, NULL},
 };
 
-static const char   *TAG = "Minion";
-static ModbusSlave   minion;
-static unsigned long timestamp = 0;
+static const register_descriptor_t registers[] = {HOLDING_REGISTERS(REGISTER_ENTRY) COILS(REGISTER_ENTRY)};
+// Address to descriptor index, sized by the highest mapped address
+static const uint8_t holding_register_map[] = {HOLDING_REGISTERS(REGISTER_MAP)};
+static const uint8_t coil_map[]             = {COILS(REGISTER_MAP)};
+
+static const char         *TAG = "Minion";
+static ModbusSlave         minion;
+static unsigned long       timestamp  = 0;
+static portMUX_TYPE        stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static minion_turnaround_t turnaround = {0};
+static uint8_t             response_buffer[RESPONSE_BUFFER_SIZE];
+static uint32_t            diagnostics[MINION_DIAGNOSTIC_NUM] = {0};
+static uint8_t             diagnostics_reset_requested        = 0;
+
+// Serial parameters change: applied once the response is out, saved only after a heartbeat at the new rate
+static struct {
+    uint8_t       pending;
+    uint8_t       unconfirmed;
+    uint32_t      baudrate;
+    uint8_t       parity;
+    unsigned long timestamp;
+} serial_switch = {0};
+// Index of the first event shown in the logs window (low word)
+static uint16_t logs_cursor = 0;
+// Model state served to register reads, taken once per request
+static model_snapshot_t snapshot       = {0};
+static uint8_t          snapshot_valid = 0;
+// Safety message registers written by the current request, saved as a whole once the request has been handled
+static struct {
+    uint8_t pending;
+    char    text[EASYCONNECT_MESSAGE_SIZE + 1];
+} staged_message = {0};
 
 
 void minion_init(easyconnect_interface_t *context) {
@@ -99,7 +306,7 @@ void minion_init(easyconnect_interface_t *context) {
         modbusSlaveInit(&minion,
                         register_callback,          // Callback for register operations
                         exception_callback,         // Callback for handling minion exceptions (optional)
-                        modbusDefaultAllocator,     // Memory allocator for allocating responses
+                        response_allocator,         // Memory allocator for allocating responses
                         custom_functions,           // Set of supported functions
                         sizeof(custom_functions) / sizeof(custom_functions[0]) - 1     // Number of supported functions
         );
@@ -112,258 +319,524 @@ void minion_init(easyconnect_interface_t *context) {
 }
 
 
+/*
+ * Handles every frame received so far without waiting; the caller is woken up by the RS485 notification
+ */
 void minion_manage(void) {
-    uint8_t buffer[256] = {0};
-    int     len         = rs485_read(buffer, sizeof(buffer));
+    static rs485_frame_t frame = {0};
+    int                  len   = 0;
+    uint32_t             start = timing_start();
 
     easyconnect_interface_t *context = modbusSlaveGetUserPointer(&minion);
 
-    if (len > 0) {
-        ModbusErrorInfo err;
-        err = modbusParseRequestRTU(&minion, context->get_address(context->arg), buffer, len);
+    while ((len = rs485_read_frame(&frame, 0)) > 0) {
+        uint16_t address = context->get_address(context->arg);
 
-        if (modbusIsOk(err)) {
-            size_t rlen = modbusSlaveGetResponseLength(&minion);
-            if (rlen > 0) {
-                rs485_write((uint8_t *)modbusSlaveGetResponse(&minion), rlen);
-            } else {
-                ESP_LOGD(TAG, "Empty response");
+        if (__atomic_load_n(&diagnostics_reset_requested, __ATOMIC_RELAXED)) {
+            memset(diagnostics, 0, sizeof(diagnostics));
+            __atomic_store_n(&diagnostics_reset_requested, 0, __ATOMIC_RELAXED);
+        }
+
+        diagnostics[MINION_DIAGNOSTIC_BUS_MESSAGES]++;
+        if (!frame.crc_ok) {
+            diagnostics[MINION_DIAGNOSTIC_CRC_ERRORS]++;
+        }
+
+        if (is_addressed_to_us(frame.data, len, address)) {
+            snapshot_valid = 0;
+
+            ModbusErrorInfo err;
+            err = modbusParseRequestRTU(&minion, address, frame.data, len);
+            apply_staged_message(context);
+
+            if (modbusIsOk(err)) {
+                diagnostics[MINION_DIAGNOSTIC_SERVER_MESSAGES]++;
+
+                size_t rlen = modbusSlaveGetResponseLength(&minion);
+                if (rlen > 0) {
+                    rs485_write((uint8_t *)modbusSlaveGetResponse(&minion), rlen);
+                    update_turnaround(frame.timestamp, esp_timer_get_time());
+                } else {
+                    diagnostics[MINION_DIAGNOSTIC_SERVER_NO_RESPONSE]++;
+                    ESP_LOGD(TAG, "Empty response");
+                }
+            } else if (err.error != MODBUS_ERROR_ADDRESS && err.error != MODBUS_ERROR_CRC) {
+                ESP_LOGW(TAG, "Invalid request with source %i and error %i", err.source, err.error);
+                ESP_LOG_BUFFER_HEX(TAG, frame.data, len);
             }
-        } else if (err.error != MODBUS_ERROR_ADDRESS && err.error != MODBUS_ERROR_CRC) {
-            ESP_LOGW(TAG, "Invalid request with source %i and error %i", err.source, err.error);
-            ESP_LOG_BUFFER_HEX(TAG, buffer, len);
+        } else {
+            diagnostics[MINION_DIAGNOSTIC_SKIPPED_FRAMES]++;
         }
     }
 
+    manage_serial_switch(context);
+
     if (is_expired(timestamp, get_millis(), EASYCONNECT_HEARTBEAT_TIMEOUT)) {
         if (model_get_missing_heartbeat(context->arg) == 0) {
             model_set_missing_heartbeat(context->arg, 1);
+            event_log_add(EVENT_LOG_CODE_HEARTBEAT_LOST, 0);
         }
     }
+
+    timing_stop(TIMING_SECTION_MINION, start);
+}
+
+
+/*
+ * Requests a change of the serial parameters. The node falls back to the default ones if no heartbeat is
+ * received within EASYCONNECT_HEARTBEAT_TIMEOUT after the switch.
+ */
+int minion_request_serial(uint32_t baudrate, uint8_t parity) {
+    if (!rs485_is_valid_serial(baudrate, parity)) {
+        return -1;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    serial_switch.pending  = 1;
+    serial_switch.baudrate = baudrate;
+    serial_switch.parity   = parity;
+    portEXIT_CRITICAL(&stats_lock);
+    return 0;
+}
+
+
+uint32_t minion_get_diagnostic(minion_diagnostic_t diagnostic) {
+    rs485_statistics_t statistics = {0};
+
+    switch (diagnostic) {
+        case MINION_DIAGNOSTIC_OVERRUNS:
+            rs485_get_statistics(&statistics);
+            return statistics.overruns;
+
+        case MINION_DIAGNOSTIC_RECOVERED_FRAMES:
+            rs485_get_statistics(&statistics);
+            return statistics.recovered_frames;
+
+        default:
+            assert(diagnostic < MINION_DIAGNOSTIC_NUM);
+            return diagnostics[diagnostic];
+    }
+}
+
+
+/*
+ * The counters are only touched by the task running `minion_manage`, which clears them before handling the next
+ * frame
+ */
+void minion_clear_diagnostics(void) {
+    __atomic_store_n(&diagnostics_reset_requested, 1, __ATOMIC_RELAXED);
+    rs485_clear_statistics();
+}
+
+
+void minion_get_turnaround(minion_turnaround_t *stats) {
+    portENTER_CRITICAL(&stats_lock);
+    *stats = turnaround;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+
+/*
+ * Upper bound of the histogram bucket holding the given fraction of the responses, clamped to the maximum
+ * seen; the estimate is within a factor of two of the actual value.
+ */
+uint32_t minion_turnaround_percentile(const minion_turnaround_t *stats, unsigned permille) {
+    if (stats->count == 0) {
+        return 0;
+    }
+
+    // Number of responses that must fall at or below the result, rounded up
+    uint64_t target     = ((uint64_t)stats->count * permille + 999) / 1000;
+    uint64_t cumulative = 0;
+
+    for (size_t i = 0; i < MINION_TURNAROUND_BUCKETS - 1; i++) {
+        cumulative += stats->buckets[i];
+        if (cumulative >= target) {
+            uint32_t bound = (1UL << (i + 1)) - 1;
+            return bound < stats->max ? bound : stats->max;
+        }
+    }
+
+    return stats->max;
 }
 
 
 static ModbusError register_callback(const ModbusSlave *status, const ModbusRegisterCallbackArgs *args,
                                      ModbusRegisterCallbackResult *result) {
 
-    easyconnect_interface_t *context = modbusSlaveGetUserPointer(status);
-    result->exceptionCode            = MODBUS_EXCEP_NONE;
+    uint32_t                     start      = timing_start();
+    easyconnect_interface_t     *context    = modbusSlaveGetUserPointer(status);
+    const register_descriptor_t *descriptor = NULL;
+    result->exceptionCode                   = MODBUS_EXCEP_NONE;
 
     ESP_LOGD(TAG, "%i %i %i %i", args->query, args->type, args->index, args->value);
+    switch (args->type) {
+        case MODBUS_HOLDING_REGISTER:
+            descriptor = lookup_register(holding_register_map, sizeof(holding_register_map), args->index);
+            break;
+
+        case MODBUS_COIL:
+            descriptor = lookup_register(coil_map, sizeof(coil_map), args->index);
+            break;
+
+        default:
+            result->exceptionCode = MODBUS_EXCEP_ILLEGAL_FUNCTION;
+            timing_stop(TIMING_SECTION_REGISTER, start);
+            return MODBUS_OK;
+    }
+
     switch (args->query) {
         // R/W access check
         case MODBUS_REGQ_R_CHECK:
-            if (args->type == MODBUS_INPUT_REGISTER) {
-                result->exceptionCode = MODBUS_EXCEP_ILLEGAL_FUNCTION;
-            }
-
-            switch (args->index) {
-                case EASYCONNECT_HOLDING_REGISTER_ADDRESS ... EASYCONNECT_HOLDING_REGISTER_LOGS_COUNTER:
-                case EASYCONNECT_HOLDING_REGISTER_LOGS ... EASYCONNECT_HOLDING_REGISTER_MESSAGE_1 - 1:
-                case EASYCONNECT_HOLDING_REGISTER_MESSAGE_1 ... EASYCONNECT_HOLDING_REGISTER_MESSAGE_2 - 1:
-                case HOLDING_REGISTER_SPEED:
-                    result->exceptionCode = MODBUS_EXCEP_NONE;
-                    break;
-
-                default:
-                    result->exceptionCode = MODBUS_EXCEP_ILLEGAL_ADDRESS;
-                    break;
+            if (descriptor == NULL || (descriptor->access & REGISTER_ACCESS_R) == 0) {
+                result->exceptionCode = MODBUS_EXCEP_ILLEGAL_ADDRESS;
             }
             break;
 
-        case MODBUS_REGQ_W_CHECK: {
-            switch (args->type) {
-                case MODBUS_HOLDING_REGISTER: {
-                    switch (args->index) {
-                        case EASYCONNECT_HOLDING_REGISTER_ADDRESS:
-                            if (args->value == 0 || args->value > 255) {
-                                result->exceptionCode = MODBUS_EXCEP_ILLEGAL_VALUE;
-                            }
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_CLASS: {
-                            break;
-                        }
-
-                        case HOLDING_REGISTER_SPEED:
-                            if (args->value > 100) {
-                                result->exceptionCode = MODBUS_EXCEP_ILLEGAL_VALUE;
-                            }
-                            break;
-
-                        case HOLDING_REGISTER_SAFETY_MESSAGE ... HOLDING_REGISTER_FEEDBACK_MESSAGE - 1: {
-                            char msg[EASYCONNECT_MESSAGE_SIZE + 1] = {0};
-                            model_get_safety_message(context->arg, msg);
-                            size_t i      = args->index - HOLDING_REGISTER_SAFETY_MESSAGE;
-                            result->value = msg[i * 2] << 8 | msg[i * 2 + 1];
-                            break;
-                        }
-
-                        default:
-                            break;
-                    }
-                    break;
-                }
-
-                case MODBUS_COIL:
-                    if (args->index >= 1) {
-                        result->exceptionCode = MODBUS_EXCEP_ILLEGAL_ADDRESS;
-                    }
-                    break;
-
-                default:
-                    result->exceptionCode = MODBUS_EXCEP_ILLEGAL_FUNCTION;
-                    break;
+        case MODBUS_REGQ_W_CHECK:
+            if (descriptor == NULL || (descriptor->access & REGISTER_ACCESS_W) == 0) {
+                result->exceptionCode = MODBUS_EXCEP_ILLEGAL_ADDRESS;
+            } else if (args->value < descriptor->min || args->value > descriptor->max) {
+                result->exceptionCode = MODBUS_EXCEP_ILLEGAL_VALUE;
             }
             break;
-        }
 
         // Read register
         case MODBUS_REGQ_R:
-            switch (args->type) {
-                case MODBUS_HOLDING_REGISTER: {
-                    switch (args->index) {
-                        case EASYCONNECT_HOLDING_REGISTER_ADDRESS:
-                            result->value = context->get_address(context->arg);
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_FIRMWARE_VERSION:
-                            result->value = EASYCONNECT_FIRMWARE_VERSION(APP_CONFIG_FIRMWARE_VERSION_MAJOR,
-                                                                         APP_CONFIG_FIRMWARE_VERSION_MINOR,
-                                                                         APP_CONFIG_FIRMWARE_VERSION_PATCH);
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_CLASS:
-                            result->value = context->get_class(context->arg);
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_1:
-                            result->value = (context->get_serial_number(context->arg) >> 16) & 0xFFFF;
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_2:
-                            result->value = context->get_serial_number(context->arg) & 0xFFFF;
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_ALARMS:
-                            result->value = (safety_ok() == 0);
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_STATE:
-                            result->value =
-                                model_get_motor_active(context->arg) | (model_get_speed_percentage(context->arg) << 8);
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_LOGS_COUNTER:
-                            result->value = 0;
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_LOGS ... EASYCONNECT_HOLDING_REGISTER_MESSAGE_1 - 1: {
-                            result->value = 0;
-                            break;
-                        }
-
-                        case EASYCONNECT_HOLDING_REGISTER_MESSAGE_1 ... EASYCONNECT_HOLDING_REGISTER_MESSAGE_2 - 1: {
-                            char msg[EASYCONNECT_MESSAGE_SIZE + 1] = {0};
-                            model_get_safety_message(context->arg, msg);
-                            size_t i      = args->index - EASYCONNECT_HOLDING_REGISTER_MESSAGE_1;
-                            result->value = msg[i * 2] << 8 | msg[i * 2 + 1];
-                            break;
-                        }
-
-                        case HOLDING_REGISTER_SPEED:
-                            result->value = model_get_speed_percentage(context->arg);
-                            break;
-                    }
-                    break;
-                }
-                case MODBUS_INPUT_REGISTER:
-                    break;
-                case MODBUS_COIL:
-                    break;
-                case MODBUS_DISCRETE_INPUT:
-                    break;
+            if (!snapshot_valid) {
+                model_take_snapshot(context->arg, &snapshot);
+                snapshot_valid = 1;
             }
+            result->value = descriptor->read(&snapshot, args->index - descriptor->first);
             break;
 
         // Write register
         case MODBUS_REGQ_W:
-            switch (args->type) {
-                case MODBUS_HOLDING_REGISTER: {
-                    switch (args->index) {
-                        case EASYCONNECT_HOLDING_REGISTER_ADDRESS:
-                            context->save_address(context->arg, args->value);
-                            break;
-
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_1: {
-                            uint32_t current_serial_number = context->get_serial_number(context->arg);
-                            context->save_serial_number(context->arg,
-                                                        (args->value << 16) | (current_serial_number & 0xFFFF));
-                            break;
-                        }
-
-                        case EASYCONNECT_HOLDING_REGISTER_SERIAL_NUMBER_2: {
-                            uint32_t current_serial_number = context->get_serial_number(context->arg);
-                            context->save_serial_number(context->arg,
-                                                        args->value | (current_serial_number & 0xFFFF0000));
-                            break;
-                        }
-
-                        case EASYCONNECT_HOLDING_REGISTER_CLASS: {
-                            context->save_class(context->arg, args->value);
-                            break;
-                        }
-
-                        case HOLDING_REGISTER_SPEED: {
-                            uint16_t percentage = args->value;
-                            if (percentage > 100) {
-                                percentage = 100;
-                            }
-                            ESP_LOGI(TAG, "Speed %i", percentage);
-                            motor_set_speed(context->arg, percentage);
-                            break;
-                        }
-                    }
-                    break;
-                }
-
-                case MODBUS_COIL:
-                    switch (args->index) {
-                        case COIL_MOTOR_STATE:
-                            if (args->value) {
-                                motor_turn_on(context->arg);
-                            } else {
-                                motor_turn_off(context->arg);
-                            }
-                            break;
-
-                        case COIL_SAFETY_BYPASS:
-                            model_set_safety_bypass(context->arg, args->value);
-                            break;
-                    }
-                    break;
-
-                case MODBUS_INPUT_REGISTER:
-                    break;
-
-                default:
-                    break;
-            }
+            descriptor->write(context, args->index - descriptor->first, args->value);
+            snapshot_valid = 0;
             break;
     }
 
+    timing_stop(TIMING_SECTION_REGISTER, start);
     // Always return MODBUS_OK
     return MODBUS_OK;
 }
 
 
+static const register_descriptor_t *lookup_register(const uint8_t *map, size_t map_size, uint16_t index) {
+    if (index >= map_size || map[index] == REGISTER_ID_NONE) {
+        return NULL;
+    } else {
+        return &registers[map[index]];
+    }
+}
+
+
+static uint16_t read_address(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->address;
+}
+
+
+static void write_address(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    context->save_address(context->arg, value);
+}
+
+
+static uint16_t read_firmware_version(const model_snapshot_t *snapshot, uint16_t offset) {
+    return EASYCONNECT_FIRMWARE_VERSION(APP_CONFIG_FIRMWARE_VERSION_MAJOR, APP_CONFIG_FIRMWARE_VERSION_MINOR,
+                                        APP_CONFIG_FIRMWARE_VERSION_PATCH);
+}
+
+
+static uint16_t read_class(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->class;
+}
+
+
+static void write_class(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    context->save_class(context->arg, value);
+}
+
+
+static uint16_t read_serial_number_1(const model_snapshot_t *snapshot, uint16_t offset) {
+    return (snapshot->serial_number >> 16) & 0xFFFF;
+}
+
+
+static void write_serial_number_1(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    uint32_t current_serial_number = context->get_serial_number(context->arg);
+    context->save_serial_number(context->arg, (value << 16) | (current_serial_number & 0xFFFF));
+}
+
+
+static uint16_t read_serial_number_2(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->serial_number & 0xFFFF;
+}
+
+
+static void write_serial_number_2(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    uint32_t current_serial_number = context->get_serial_number(context->arg);
+    context->save_serial_number(context->arg, value | (current_serial_number & 0xFFFF0000));
+}
+
+
+static uint16_t read_alarms(const model_snapshot_t *snapshot, uint16_t offset) {
+    return safety_ok() == 0;
+}
+
+
+static uint16_t read_state(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->motor_active | (snapshot->speed_percentage << 8);
+}
+
+
+static uint16_t read_logs_counter(const model_snapshot_t *snapshot, uint16_t offset) {
+    return event_log_count() & 0xFFFF;
+}
+
+
+/*
+ * The logs window starts with the event selected by the cursor register, which follows the low word of the
+ * counter. Events that are not available anymore read as 0.
+ */
+static uint16_t read_logs(const model_snapshot_t *snapshot, uint16_t offset) {
+    uint32_t          count = event_log_count();
+    uint32_t          first = count - (uint16_t)((uint16_t)count - logs_cursor);
+    event_log_entry_t entry = {0};
+
+    if (event_log_get(first + offset / LOG_ENTRY_REGISTERS, &entry)) {
+        return 0;
+    }
+
+    switch (offset % LOG_ENTRY_REGISTERS) {
+        case 0:
+            return entry.sequence & 0xFFFF;
+        case 1:
+            return (entry.timestamp >> 16) & 0xFFFF;
+        case 2:
+            return entry.timestamp & 0xFFFF;
+        case 3:
+            return entry.code;
+        default:
+            return entry.data;
+    }
+}
+
+
+static uint16_t read_safety_message(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->safety_message[offset * 2] << 8 | snapshot->safety_message[offset * 2 + 1];
+}
+
+
+/*
+ * Each register holds two characters, the first one in the high byte. A write only touches the staging copy:
+ * a whole FC16 block costs a single model update and a single flash commit.
+ */
+static void write_safety_message(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    if (!staged_message.pending) {
+        memset(staged_message.text, 0, sizeof(staged_message.text));
+        model_get_safety_message(context->arg, staged_message.text);
+        staged_message.pending = 1;
+    }
+
+    staged_message.text[offset * 2]     = (char)(value >> 8);
+    staged_message.text[offset * 2 + 1] = (char)(value & 0xFF);
+}
+
+
+static uint16_t read_speed(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->speed_percentage;
+}
+
+
+static void write_speed(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    ESP_LOGI(TAG, "Speed %i", value);
+    motor_set_speed(context->arg, value);
+}
+
+
+static uint16_t read_diagnostics(const model_snapshot_t *snapshot, uint16_t offset) {
+    return minion_get_diagnostic(offset) & 0xFFFF;
+}
+
+
+static uint16_t read_logs_cursor(const model_snapshot_t *snapshot, uint16_t offset) {
+    return logs_cursor;
+}
+
+
+static void write_logs_cursor(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    logs_cursor = value;
+}
+
+
+static uint16_t read_timing(const model_snapshot_t *snapshot, uint16_t offset) {
+    timing_stats_t stats = {0};
+    timing_get(offset / TIMING_REGISTERS, &stats);
+
+    uint32_t value = 0;
+    switch (offset % TIMING_REGISTERS) {
+        case 0:
+            return stats.count & 0xFFFF;
+        case 1:
+            value = stats.count > 0 ? timing_cycles_to_us((uint32_t)(stats.total / stats.count)) : 0;
+            break;
+        case 2:
+            value = timing_cycles_to_us(stats.max);
+            break;
+        case 3:
+            value = stats.misses;
+            break;
+        default:
+            value = stats.buckets[offset % TIMING_REGISTERS - 4];
+            break;
+    }
+
+    return value > 0xFFFF ? 0xFFFF : value;
+}
+
+
+static uint16_t read_acceleration(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->acceleration;
+}
+
+
+static void write_acceleration(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    configuration_save_ramp(context->arg, value, model_get_deceleration(context->arg),
+                            model_get_ramp_profile(context->arg));
+}
+
+
+static uint16_t read_deceleration(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->deceleration;
+}
+
+
+static void write_deceleration(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    configuration_save_ramp(context->arg, model_get_acceleration(context->arg), value,
+                            model_get_ramp_profile(context->arg));
+}
+
+
+static uint16_t read_ramp_profile(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->ramp_profile;
+}
+
+
+static void write_ramp_profile(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    configuration_save_ramp(context->arg, model_get_acceleration(context->arg), model_get_deceleration(context->arg),
+                            value);
+}
+
+
+static uint16_t read_duty(const model_snapshot_t *snapshot, uint16_t offset) {
+    uint16_t current = 0;
+    uint16_t target  = 0;
+    motor_get_duty(&current, &target);
+    return offset == 0 ? current : target;
+}
+
+
+static uint16_t read_speed_permille(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->speed_permille;
+}
+
+
+static void write_speed_permille(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    motor_set_speed_permille(context->arg, value);
+}
+
+
+static uint16_t read_rpm(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->measured_rpm;
+}
+
+
+static uint16_t read_max_rpm(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->max_rpm;
+}
+
+
+static void write_max_rpm(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    configuration_save_speed_control(context->arg, model_get_speed_mode(context->arg), value);
+}
+
+
+static uint16_t read_motor_state(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->motor_active;
+}
+
+
+static void write_motor_state(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    if (value) {
+        motor_turn_on(context->arg);
+    } else {
+        motor_turn_off(context->arg);
+    }
+}
+
+
+static uint16_t read_safety_bypass(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->safety_bypass;
+}
+
+
+static void write_safety_bypass(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    model_set_safety_bypass(context->arg, value);
+}
+
+
+static uint16_t read_timing_reset(const model_snapshot_t *snapshot, uint16_t offset) {
+    return 0;
+}
+
+
+static void write_timing_reset(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    if (value) {
+        timing_reset();
+    }
+}
+
+
+static uint16_t read_speed_closed_loop(const model_snapshot_t *snapshot, uint16_t offset) {
+    return snapshot->speed_mode == SPEED_MODE_CLOSED_LOOP;
+}
+
+
+static void write_speed_closed_loop(easyconnect_interface_t *context, uint16_t offset, uint16_t value) {
+    configuration_save_speed_control(context->arg, value ? SPEED_MODE_CLOSED_LOOP : SPEED_MODE_OPEN_LOOP,
+                                     model_get_max_rpm(context->arg));
+}
+
+
 static ModbusError exception_callback(const ModbusSlave *minion, uint8_t function, ModbusExceptionCode code) {
     ESP_LOGW(TAG, "Minion reports an exception %d (function %d)", code, function);
+    diagnostics[MINION_DIAGNOSTIC_EXCEPTIONS]++;
     // Always return MODBUS_OK
     return MODBUS_OK;
 }
 
 
+/*
+ * The slave only ever holds one response at a time, so every allocation is served from the same static buffer
+ */
+static ModbusError response_allocator(ModbusBuffer *buffer, uint16_t size, void *context) {
+    (void)context;
+
+    if (size == 0) {
+        buffer->data = NULL;
+        return MODBUS_OK;
+    } else if (size > sizeof(response_buffer)) {
+        ESP_LOGW(TAG, "Response of %i bytes exceeds the buffer", size);
+        buffer->data = NULL;
+        return MODBUS_ERROR_ALLOC;
+    } else {
+        buffer->data = response_buffer;
+        return MODBUS_OK;
+    }
+}
+
+
 static LIGHTMODBUS_RET_ERROR initialization_function(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
                                                      uint8_t requestLength) {
     easyconnect_interface_t *ctx = modbusSlaveGetUserPointer(minion);
@@ -396,10 +869,165 @@ static LIGHTMODBUS_RET_ERROR set_class_output(ModbusSlave *minion, uint8_t funct
 }
 
 
+/*
+ * Serial line diagnostics (FC08); only the sub-functions with a fixed size request are supported
+ */
+static LIGHTMODBUS_RET_ERROR diagnostics_function(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                                  uint8_t requestLength) {
+    // Check request length
+    if (requestLength != 5) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+
+    uint16_t subfunction = requestPDU[1] << 8 | requestPDU[2];
+    uint16_t value       = requestPDU[3] << 8 | requestPDU[4];
+
+    switch (subfunction) {
+        case DIAGNOSTICS_RETURN_QUERY_DATA:
+            break;
+
+        case DIAGNOSTICS_CLEAR_COUNTERS:
+            minion_clear_diagnostics();
+            break;
+
+        case DIAGNOSTICS_RETURN_BUS_MESSAGE_COUNT:
+            value = minion_get_diagnostic(MINION_DIAGNOSTIC_BUS_MESSAGES);
+            break;
+
+        case DIAGNOSTICS_RETURN_BUS_ERROR_COUNT:
+            value = minion_get_diagnostic(MINION_DIAGNOSTIC_CRC_ERRORS);
+            break;
+
+        case DIAGNOSTICS_RETURN_EXCEPTION_COUNT:
+            value = minion_get_diagnostic(MINION_DIAGNOSTIC_EXCEPTIONS);
+            break;
+
+        case DIAGNOSTICS_RETURN_SERVER_MESSAGE_COUNT:
+            value = minion_get_diagnostic(MINION_DIAGNOSTIC_SERVER_MESSAGES);
+            break;
+
+        case DIAGNOSTICS_RETURN_SERVER_NO_RESPONSE:
+            value = minion_get_diagnostic(MINION_DIAGNOSTIC_SERVER_NO_RESPONSE);
+            break;
+
+        case DIAGNOSTICS_RETURN_CHARACTER_OVERRUNS:
+            value = minion_get_diagnostic(MINION_DIAGNOSTIC_OVERRUNS);
+            break;
+
+        case DIAGNOSTICS_CLEAR_OVERRUN_COUNTER:
+            rs485_clear_overruns();
+            break;
+
+        default:
+            return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_FUNCTION);
+    }
+
+    if (!modbusIsOk(modbusSlaveAllocateResponse(minion, 5))) {
+        return MODBUS_GENERAL_ERROR(ALLOC);
+    }
+    minion->response.pdu[0] = function;
+    minion->response.pdu[1] = requestPDU[1];
+    minion->response.pdu[2] = requestPDU[2];
+    minion->response.pdu[3] = (value >> 8) & 0xFF;
+    minion->response.pdu[4] = value & 0xFF;
+
+    return MODBUS_NO_ERROR();
+}
+
+
+/*
+ * Speed, output and safety bypass in a single request: [function, speed, output, bypass]
+ */
+static LIGHTMODBUS_RET_ERROR set_fan_state(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                           uint8_t requestLength) {
+    // Check request length
+    if (requestLength < 4) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+    if (requestPDU[1] > 100) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+
+    easyconnect_interface_t *ctx = modbusSlaveGetUserPointer(minion);
+    ESP_LOGI(TAG, "Fan state: output %i, percentage %i, bypass %i", requestPDU[2], requestPDU[1], requestPDU[3]);
+    motor_set_state(ctx->arg, requestPDU[1], requestPDU[2], requestPDU[3]);
+
+    // Echo the request back, as for the standard write functions
+    if (!modbusIsOk(modbusSlaveAllocateResponse(minion, 4))) {
+        return MODBUS_GENERAL_ERROR(ALLOC);
+    }
+    memcpy(minion->response.pdu, requestPDU, 4);
+
+    return MODBUS_NO_ERROR();
+}
+
+
+/*
+ * Broadcast variant of `set_fan_state` for a whole class: [function, class (2 bytes), speed, output, bypass]
+ */
+static LIGHTMODBUS_RET_ERROR set_class_fan_state(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                                 uint8_t requestLength) {
+    // Check request length
+    if (requestLength < 6) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+    if (requestPDU[3] > 100) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+
+    easyconnect_interface_t *ctx = modbusSlaveGetUserPointer(minion);
+    uint16_t class               = requestPDU[1] << 8 | requestPDU[2];
+    if (class == ctx->get_class(ctx->arg)) {
+        ESP_LOGI(TAG, "Class fan state: output %i, percentage %i, bypass %i", requestPDU[4], requestPDU[3],
+                 requestPDU[5]);
+        motor_set_state(ctx->arg, requestPDU[3], requestPDU[4], requestPDU[5]);
+    }
+
+    return MODBUS_NO_ERROR();
+}
+
+
+/*
+ * Baud rate and parity change: [function, baud rate (4 bytes), parity]
+ */
+static LIGHTMODBUS_RET_ERROR set_serial(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
+                                        uint8_t requestLength) {
+    // Check request length
+    if (requestLength < 6) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+
+    uint32_t baudrate = 0;
+    deserialize_uint32_be(&baudrate, (uint8_t *)&requestPDU[1]);
+
+    if (minion_request_serial(baudrate, requestPDU[5])) {
+        return modbusBuildException(minion, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+    }
+
+    // Answered at the current rate, the switch happens right after
+    if (!modbusIsOk(modbusSlaveAllocateResponse(minion, 6))) {
+        return MODBUS_GENERAL_ERROR(ALLOC);
+    }
+    memcpy(minion->response.pdu, requestPDU, 6);
+
+    return MODBUS_NO_ERROR();
+}
+
+
 static LIGHTMODBUS_RET_ERROR heartbeat_received(ModbusSlave *minion, uint8_t function, const uint8_t *requestPDU,
                                                 uint8_t requestLength) {
     easyconnect_interface_t *ctx = modbusSlaveGetUserPointer(minion);
 
+    if (serial_switch.unconfirmed) {
+        // The master is talking at the new rate, it can be kept
+        serial_switch.unconfirmed = 0;
+        // At boot the stored rate is only being confirmed, there is nothing new to save
+        if (serial_switch.baudrate != model_get_baudrate(ctx->arg) ||
+            serial_switch.parity != model_get_parity(ctx->arg)) {
+            configuration_save_serial(ctx->arg, serial_switch.baudrate, serial_switch.parity);
+        }
+    }
+
     timestamp = get_millis();
     model_set_missing_heartbeat(ctx->arg, 0);
     return MODBUS_NO_ERROR();
@@ -423,3 +1051,99 @@ static LIGHTMODBUS_RET_ERROR set_datetime(ModbusSlave *minion, uint8_t function,
 
     return MODBUS_NO_ERROR();
 }
+
+
+static void manage_serial_switch(easyconnect_interface_t *context) {
+    portENTER_CRITICAL(&stats_lock);
+    uint8_t  pending  = serial_switch.pending;
+    uint32_t baudrate = serial_switch.baudrate;
+    uint8_t  parity   = serial_switch.parity;
+
+    serial_switch.pending = 0;
+    portEXIT_CRITICAL(&stats_lock);
+
+    if (pending) {
+        if (rs485_set_serial(baudrate, parity) == 0) {
+            serial_switch.unconfirmed = 1;
+            serial_switch.timestamp   = get_millis();
+        }
+    } else if (serial_switch.unconfirmed &&
+               is_expired(serial_switch.timestamp, get_millis(), EASYCONNECT_HEARTBEAT_TIMEOUT)) {
+        ESP_LOGW(TAG, "No heartbeat after the serial change, falling back to %i baud", RS485_DEFAULT_BAUDRATE);
+        serial_switch.unconfirmed = 0;
+        rs485_set_serial(RS485_DEFAULT_BAUDRATE, RS485_PARITY_NONE);
+    }
+}
+
+
+static void apply_staged_message(easyconnect_interface_t *context) {
+    if (!staged_message.pending) {
+        return;
+    }
+    staged_message.pending = 0;
+
+    char current[EASYCONNECT_MESSAGE_SIZE + 1] = {0};
+    model_get_safety_message(context->arg, current);
+    if (strcmp(current, staged_message.text) != 0) {
+        ESP_LOGI(TAG, "New safety message: %s", staged_message.text);
+        configuration_save_safety_message(context->arg, staged_message.text);
+    }
+}
+
+
+static void update_turnaround(int64_t request, int64_t response) {
+    uint32_t microseconds = (uint32_t)(response - request);
+    // Position of the highest set bit
+    unsigned bucket = microseconds > 0 ? 31 - __builtin_clz(microseconds) : 0;
+    if (bucket >= MINION_TURNAROUND_BUCKETS) {
+        bucket = MINION_TURNAROUND_BUCKETS - 1;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    uint8_t first = turnaround.count == 0;
+    if (first) {
+        turnaround.first_response = response;
+    }
+    turnaround.count++;
+    turnaround.last = microseconds;
+    turnaround.total += microseconds;
+    turnaround.buckets[bucket]++;
+    if (microseconds > turnaround.max) {
+        turnaround.max = microseconds;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    if (first) {
+        ESP_LOGI(TAG, "First response %llums after reset", (unsigned long long)(response / 1000));
+    }
+}
+
+
+/*
+ * Cheap check on the address byte, done before any CRC or parsing work. Broadcasts and the EasyConnect
+ * custom functions are always let through, as they concern the whole bus.
+ */
+static uint8_t is_addressed_to_us(const uint8_t *frame, int len, uint16_t address) {
+    if (len < RTU_FRAMER_MIN_FRAME_SIZE) {
+        // Let the parser deal with it
+        return 1;
+    }
+
+    if (frame[0] == address || frame[0] == 0) {
+        return 1;
+    }
+
+    switch (frame[1]) {
+        case EASYCONNECT_FUNCTION_CODE_CONFIG_ADDRESS:
+        case EASYCONNECT_FUNCTION_CODE_RANDOM_SERIAL_NUMBER:
+        case EASYCONNECT_FUNCTION_CODE_NETWORK_INITIALIZATION:
+        case EASYCONNECT_FUNCTION_CODE_SET_CLASS_OUTPUT:
+        case EASYCONNECT_FUNCTION_CODE_SET_TIME:
+        case EASYCONNECT_FUNCTION_CODE_HEARTBEAT:
+        case FUNCTION_CODE_SET_CLASS_FAN_STATE:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
@@ -2,10 +2,43 @@
 #define MINION_H_INCLUDED
 
 
+#include <stdint.h>
 #include "easyconnect_interface.h"
 
 
-void minion_init(easyconnect_interface_t *context);
-void minion_manage(void);
+typedef enum {
+    MINION_DIAGNOSTIC_BUS_MESSAGES = 0,
+    MINION_DIAGNOSTIC_CRC_ERRORS,
+    MINION_DIAGNOSTIC_EXCEPTIONS,
+    MINION_DIAGNOSTIC_SERVER_MESSAGES,
+    MINION_DIAGNOSTIC_SERVER_NO_RESPONSE,
+    MINION_DIAGNOSTIC_OVERRUNS,
+    MINION_DIAGNOSTIC_SKIPPED_FRAMES,
+    MINION_DIAGNOSTIC_RECOVERED_FRAMES,
+    MINION_DIAGNOSTIC_NUM,
+} minion_diagnostic_t;
+
+
+// Bucket i counts turnarounds between 2^i and 2^(i+1) - 1 us; the last one takes everything longer
+#define MINION_TURNAROUND_BUCKETS 16
+
+
+typedef struct {
+    uint32_t count;     // Responses sent
+    uint32_t last;      // Last request-to-response time, in us
+    uint32_t max;
+    uint64_t total;
+    int64_t  first_response;     // Time of the first response since reset, in us
+    uint32_t buckets[MINION_TURNAROUND_BUCKETS];
+} minion_turnaround_t;
+
+
+void     minion_init(easyconnect_interface_t *context);
+void     minion_manage(void);
+void     minion_get_turnaround(minion_turnaround_t *stats);
+uint32_t minion_turnaround_percentile(const minion_turnaround_t *stats, unsigned permille);
+uint32_t minion_get_diagnostic(minion_diagnostic_t diagnostic);
+void     minion_clear_diagnostics(void);
+int      minion_request_serial(uint32_t baudrate, uint8_t parity);
 
 #endif
\ No newline at end of file
@@ -1,26 +1,57 @@
 #include <driver/gpio.h>
 #include <driver/ledc.h>
+#include <soc/gpio_sig_map.h>
 #include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
 #include "esp_log.h"
 #include "peripherals/heartbeat.h"
 #include "peripherals/hardwareprofile.h"
+#include "peripherals/trip.h"
+#include "peripherals/outputs.h"
+#include "peripherals/zero_cross.h"
 #include "motor.h"
 #include "safety.h"
 #include "utils/utils.h"
 #include "gel/timer/timecheck.h"
 #include "model/model.h"
+#include "event_log.h"
+#include "linearization.h"
+#include "phase.h"
 
 
-#define PWM_MODE    LEDC_LOW_SPEED_MODE
-#define PWM_CHANNEL LEDC_CHANNEL_0
-#define PWM_TIMER   LEDC_TIMER_1
+#define DUTY_RESOLUTION LEDC_TIMER_13_BIT
+#define DUTY_MAX        (1 << DUTY_RESOLUTION)
 
+// Update period of the S-curve generator
+#define RAMP_STEP_US 5000
 
-static void set_duty_percentage(uint8_t percentage);
+
+static void set_duty_permille(model_t *pmodel, uint16_t permille, uint8_t ramp);
+static void set_duty(uint32_t duty);
+static void set_output(uint8_t level);
+static void apply_speed(model_t *pmodel, uint16_t permille);
+static void ramp_step(void *args);
 
 
 static const char *TAG = "Motor";
 
+/*
+ *  Speed changes move the duty towards the target at the configured rate. Linear ramps run on the LEDC fade
+ *  hardware, S-curves are stepped by a timer; either way nobody waits for them. Turning off is immediate.
+ */
+static portMUX_TYPE       ramp_lock  = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t ramp_timer = NULL;
+static struct {
+    uint32_t start;
+    uint32_t target;
+    int64_t  start_time;
+    uint32_t duration_us;
+    uint8_t  stepped;     // An S-curve is running
+    uint8_t  faded;       // A hardware fade is running
+} ramp = {0};
+// Duty requested by the speed controller, used instead of the speed while in closed loop
+static uint16_t closed_loop_permille = 0;
+
 
 void motor_init(model_t *pmodel) {
     gpio_config_t config = {
@@ -33,25 +64,40 @@ void motor_init(model_t *pmodel) {
     ESP_ERROR_CHECK(gpio_config(&config));
 
     ledc_timer_config_t ledc_timer = {
-        .duty_resolution = LEDC_TIMER_10_BIT,     // resolution of PWM duty
+        .duty_resolution = DUTY_RESOLUTION,       // resolution of PWM duty
         .freq_hz         = 1000,                  // frequency of PWM signal
-        .speed_mode      = PWM_MODE,              // timer mode
-        .timer_num       = PWM_TIMER,             // timer index
+        .speed_mode      = HAP_PWM_MODE,          // timer mode
+        .timer_num       = HAP_PWM_TIMER,         // timer index
         .clk_cfg         = LEDC_AUTO_CLK,         // Auto select the source clock
     };
     // Set configuration of timer0 for high speed channels
     ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
 
     ledc_channel_config_t ledc_channel = {
-        .channel             = PWM_CHANNEL,
+        .channel             = HAP_PWM_CHANNEL,
         .duty                = 0,
         .gpio_num            = HAP_PWM,
-        .speed_mode          = PWM_MODE,
+        .speed_mode          = HAP_PWM_MODE,
         .hpoint              = 0,
-        .timer_sel           = PWM_TIMER,
+        .timer_sel           = HAP_PWM_TIMER,
         .flags.output_invert = 0,
     };
     ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+    ESP_ERROR_CHECK(ledc_fade_func_install(0));
+
+    esp_timer_create_args_t timer_args = {
+        .callback        = ramp_step,
+        .arg             = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name            = "ramp",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &ramp_timer));
+
+    // The trip reconnects this signal to HAP_PWM when released
+    trip_init(LEDC_LS_SIG_OUT0_IDX + HAP_PWM_CHANNEL);
+    // Synchronized output changes are applied straight from the crossing interrupt
+    zero_cross_init();
+    zero_cross_set_hook(trip_zero_cross);
 
     motor_turn_off(pmodel);
     ESP_LOGI(TAG, "Initialized");
@@ -63,44 +109,222 @@ void motor_set_speed(model_t *pmodel, uint8_t percentage) {
         percentage = 100;
     }
 
-    model_set_speed_percentage(pmodel, percentage);
-    set_duty_percentage(percentage);
+    motor_set_speed_permille(pmodel, percentage * 10);
+}
+
+
+void motor_set_speed_permille(model_t *pmodel, uint16_t permille) {
+    if (permille > 1000) {
+        permille = 1000;
+    }
+
+    model_set_speed_permille(pmodel, permille);
+    // While off the duty stays at 0, motor_turn_on picks the new speed up
+    if (model_get_motor_active(pmodel)) {
+        apply_speed(pmodel, permille);
+    }
 }
 
 
 void motor_turn_off(model_t *pmodel) {
+    if (model_get_motor_active(pmodel)) {
+        event_log_add(EVENT_LOG_CODE_MOTOR_OFF, 0);
+    }
     model_set_motor_active(pmodel, 0);
-    gpio_set_level(HAP_OUTPUT, 0);
-    set_duty_percentage(0);
+    set_output(0);
+    set_duty_permille(pmodel, 0, 0);
 }
 
 
 void motor_turn_on(model_t *pmodel) {
+    if (!model_get_motor_active(pmodel)) {
+        event_log_add(EVENT_LOG_CODE_MOTOR_ON, model_get_speed_percentage(pmodel));
+    }
     model_set_motor_active(pmodel, 1);
     if (safety_ok() || model_get_safety_bypass(pmodel)) {
-        gpio_set_level(HAP_OUTPUT, 1);
-        set_duty_percentage(model_get_speed_percentage(pmodel));
+        set_output(1);
+        apply_speed(pmodel, model_get_speed_permille(pmodel));
+    }
+}
+
+
+/*
+ * Applies speed, output and safety bypass together, with a single model update
+ */
+void motor_set_state(model_t *pmodel, uint8_t percentage, uint8_t active, uint8_t bypass) {
+    if (percentage > 100) {
+        percentage = 100;
+    }
+    active = active != 0;
+    bypass = bypass != 0;
+
+    if (active != model_get_motor_active(pmodel)) {
+        event_log_add(active ? EVENT_LOG_CODE_MOTOR_ON : EVENT_LOG_CODE_MOTOR_OFF, active ? percentage : 0);
+    }
+    model_set_fan_state(pmodel, percentage * 10, active, bypass);
+
+    if (!active) {
+        set_output(0);
+        set_duty_permille(pmodel, 0, 0);
+    } else if (safety_ok() || bypass) {
+        set_output(1);
+        apply_speed(pmodel, percentage * 10);
     }
 }
 
 
 void motor_refresh(model_t *pmodel) {
     if (model_get_motor_active(pmodel)) {
-        set_duty_percentage(model_get_speed_percentage(pmodel));
-        gpio_set_level(HAP_OUTPUT, 1);
+        apply_speed(pmodel, model_get_speed_permille(pmodel));
+        set_output(1);
     } else {
-        set_duty_percentage(0);
-        gpio_set_level(HAP_OUTPUT, 0);
+        set_duty_permille(pmodel, 0, 0);
+        set_output(0);
     }
 }
 
 
-static void set_duty_percentage(uint8_t percentage) {
-    if (percentage > 100) {
-        percentage = 100;
+/*
+ * Reports the duty currently output and the one being ramped to, out of DUTY_MAX
+ */
+void motor_get_duty(uint16_t *current, uint16_t *target) {
+    *current = (uint16_t)ledc_get_duty(HAP_PWM_MODE, HAP_PWM_CHANNEL);
+    portENTER_CRITICAL(&ramp_lock);
+    *target = (uint16_t)ramp.target;
+    portEXIT_CRITICAL(&ramp_lock);
+}
+
+
+/*
+ * Output of the speed controller, applied right away: its own dynamics replace the ramp
+ */
+void motor_set_closed_loop_output(model_t *pmodel, uint16_t permille) {
+    if (permille > 1000) {
+        permille = 1000;
+    }
+
+    __atomic_store_n(&closed_loop_permille, permille, __ATOMIC_RELAXED);
+    if (model_get_motor_active(pmodel) && model_get_speed_mode(pmodel) == SPEED_MODE_CLOSED_LOOP) {
+        set_duty_permille(pmodel, permille, 0);
+    }
+}
+
+
+/*
+ * Moves the duty towards the one for `permille`; without `ramp_enabled` (or with a 0 rate) the change is immediate
+ */
+static void set_duty_permille(model_t *pmodel, uint16_t permille, uint8_t ramp_enabled) {
+    uint32_t target = linearization_duty(permille, DUTY_MAX);
+
+    portENTER_CRITICAL(&ramp_lock);
+    uint32_t previous_target = ramp.target;
+    uint8_t  stepped         = ramp.stepped;
+    uint8_t  faded           = ramp.faded;
+    portEXIT_CRITICAL(&ramp_lock);
+
+    uint32_t current = ledc_get_duty(HAP_PWM_MODE, HAP_PWM_CHANNEL);
+    uint8_t  running = stepped || (faded && current != previous_target);
+
+    if (target == previous_target && (ramp_enabled || !running) && (running || current == target)) {
+        // Already there or on the way, most likely a refresh
+        return;
+    }
+
+    // Start from wherever the previous ramp got to
+    esp_timer_stop(ramp_timer);
+    ledc_fade_stop(HAP_PWM_MODE, HAP_PWM_CHANNEL);
+    current = ledc_get_duty(HAP_PWM_MODE, HAP_PWM_CHANNEL);
+
+    uint16_t rate       = target > current ? model_get_acceleration(pmodel) : model_get_deceleration(pmodel);
+    uint32_t difference = target > current ? target - current : current - target;
+    uint32_t duration   = 0;
+    if (ramp_enabled && rate > 0) {
+        // rate is in %/s
+        duration = (uint32_t)(((uint64_t)difference * 100 * 1000000) / ((uint64_t)rate * DUTY_MAX));
+    }
+    uint8_t curve = duration >= RAMP_STEP_US && model_get_ramp_profile(pmodel) == RAMP_PROFILE_S_CURVE;
+    uint8_t fade  = duration >= RAMP_STEP_US && !curve;
+
+    portENTER_CRITICAL(&ramp_lock);
+    ramp.start       = current;
+    ramp.target      = target;
+    ramp.start_time  = esp_timer_get_time();
+    ramp.duration_us = duration;
+    ramp.stepped     = curve;
+    ramp.faded       = fade;
+    portEXIT_CRITICAL(&ramp_lock);
+
+    if (curve) {
+        esp_timer_start_periodic(ramp_timer, RAMP_STEP_US);
+    } else if (fade) {
+        // The duty moves in hardware from here on
+        outputs_invalidate(OUTPUT_PWM);
+        ledc_set_fade_with_time(HAP_PWM_MODE, HAP_PWM_CHANNEL, target, duration / 1000);
+        ledc_fade_start(HAP_PWM_MODE, HAP_PWM_CHANNEL, LEDC_FADE_NO_WAIT);
+    } else {
+        set_duty(target);
+    }
+}
+
+
+static void set_duty(uint32_t duty) {
+    outputs_set(OUTPUT_PWM, duty);
+}
+
+
+/*
+ * In closed loop the speed is the speed controller's setpoint, the duty is whatever it last asked for
+ */
+static void apply_speed(model_t *pmodel, uint16_t permille) {
+    if (model_get_speed_mode(pmodel) == SPEED_MODE_CLOSED_LOOP) {
+        set_duty_permille(pmodel, __atomic_load_n(&closed_loop_permille, __ATOMIC_RELAXED), 0);
+    } else {
+        set_duty_permille(pmodel, permille, 1);
     }
+}
+
+
+/*
+ * HAP_OUTPUT switches the load: with a stable mains phase the change waits for the next zero crossing. A trip
+ * does not go through here, the interrupt cuts the output right away.
+ */
+static void set_output(uint8_t level) {
+    if (phase_is_locked()) {
+        trip_set_output_synchronized(level);
+    } else {
+        trip_set_output(level);
+    }
+}
 
-    uint32_t duty = (percentage * 1024) / 100;
-    ledc_set_duty(PWM_MODE, PWM_CHANNEL, duty);
-    ledc_update_duty(PWM_MODE, PWM_CHANNEL);
+
+/*
+ * S-curve generator: smoothstep between the start and target duty, 3p^2 - 2p^3 in Q16
+ */
+static void ramp_step(void *args) {
+    (void)args;
+
+    portENTER_CRITICAL(&ramp_lock);
+    int64_t  elapsed  = esp_timer_get_time() - ramp.start_time;
+    uint32_t start    = ramp.start;
+    uint32_t target   = ramp.target;
+    uint32_t duration = ramp.duration_us;
+    portEXIT_CRITICAL(&ramp_lock);
+
+    if (elapsed >= duration) {
+        set_duty(target);
+        esp_timer_stop(ramp_timer);
+        portENTER_CRITICAL(&ramp_lock);
+        ramp.stepped = 0;
+        portEXIT_CRITICAL(&ramp_lock);
+        return;
+    }
+
+    uint64_t p      = ((uint64_t)elapsed << 16) / duration;
+    uint64_t smooth = (p * p * (3 * 65536 - 2 * p)) >> 32;
+
+    if (target > start) {
+        set_duty(start + (uint32_t)(((target - start) * smooth) >> 16));
+    } else {
+        set_duty(start - (uint32_t)(((start - target) * smooth) >> 16));
+    }
 }
@@ -8,9 +8,13 @@
 
 void motor_init(model_t *pmodel);
 void motor_set_speed(model_t *pmodel, uint8_t percentage);
+void motor_set_speed_permille(model_t *pmodel, uint16_t permille);
 void motor_turn_off(model_t *pmodel);
 void motor_turn_on(model_t *pmodel);
 void motor_refresh(model_t *pmodel);
+void motor_set_state(model_t *pmodel, uint8_t percentage, uint8_t active, uint8_t bypass);
+void motor_get_duty(uint16_t *current, uint16_t *target);
+void motor_set_closed_loop_output(model_t *pmodel, uint16_t permille);
 
 
 #endif
\ No newline at end of file
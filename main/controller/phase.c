@@ -0,0 +1,159 @@
+#include <string.h>
+#include "phase.h"
+
+
+// Anything outside 40-70 Hz is not mains
+#define MIN_HALFPERIOD_US 7100
+#define MAX_HALFPERIOD_US 12500
+
+// The filter moves by 1/8 of the error on each sample, in Q8
+#define FILTER_SHIFT 3
+#define Q8(x)        ((x) << 8)
+
+// Samples agreeing with the estimate before switching can rely on it
+#define LOCK_SAMPLES 8
+// Deviation from the estimate still considered the same period
+#define TOLERANCE_US(halfperiod) ((halfperiod) / 8)
+// Half periods without a crossing before the lock is lost
+#define TIMEOUT_HALFPERIODS 4
+
+
+static void     unlock(void);
+static uint32_t deviation(uint32_t a, uint32_t b);
+
+
+/*
+ *  Only updated from the controller task; readers elsewhere only look at the two published values.
+ */
+volatile uint32_t calculated_phase_halfperiod = 0;
+volatile uint32_t last_phase_halfperiod       = 0;
+
+static struct {
+    int64_t            last_crossing;
+    uint32_t           filtered_q8;
+    uint32_t           jitter_q8;
+    uint16_t           agreeing;
+    phase_statistics_t statistics;
+} phase = {0};
+
+
+void phase_reset(void) {
+    memset(&phase, 0, sizeof(phase));
+    calculated_phase_halfperiod = 0;
+    last_phase_halfperiod       = 0;
+}
+
+
+/*
+ * Feeds the timestamp of a detected crossing, in microseconds
+ */
+void phase_add_crossing(int64_t timestamp) {
+    if (phase.last_crossing == 0 || timestamp <= phase.last_crossing) {
+        phase.last_crossing = timestamp;
+        return;
+    }
+
+    int64_t elapsed = timestamp - phase.last_crossing;
+    if (elapsed < MIN_HALFPERIOD_US) {
+        // Keep the previous edge as reference, the next real one will be measured from there
+        phase.statistics.rejected++;
+        return;
+    }
+    phase.last_crossing = timestamp;
+
+    uint32_t estimate = phase.filtered_q8 >> 8;
+    uint32_t interval = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+
+    if (estimate > 0 && interval > MAX_HALFPERIOD_US) {
+        // Edges may go missing with a weak detector: a multiple of the half period is still a valid sample
+        uint32_t crossings = (interval + estimate / 2) / estimate;
+        if (crossings > 1 && crossings <= TIMEOUT_HALFPERIODS &&
+            deviation(interval, crossings * estimate) <= TOLERANCE_US(estimate)) {
+            phase.statistics.missed += crossings - 1;
+            interval /= crossings;
+        }
+    }
+
+    if (interval > MAX_HALFPERIOD_US) {
+        // A gap in the signal, start over
+        unlock();
+        return;
+    }
+
+    last_phase_halfperiod = interval;
+
+    if (phase.filtered_q8 == 0) {
+        phase.filtered_q8 = Q8(interval);
+    } else {
+        uint32_t error = deviation(interval, estimate);
+        if (error > TOLERANCE_US(estimate)) {
+            phase.agreeing = 0;
+        } else if (phase.agreeing < LOCK_SAMPLES) {
+            phase.agreeing++;
+        }
+
+        if (error > phase.statistics.max_jitter_us && phase.agreeing >= LOCK_SAMPLES) {
+            phase.statistics.max_jitter_us = error;
+        }
+
+        phase.filtered_q8 = phase.filtered_q8 + (((int32_t)Q8(interval) - (int32_t)phase.filtered_q8) >> FILTER_SHIFT);
+        phase.jitter_q8   = phase.jitter_q8 + (((int32_t)Q8(error) - (int32_t)phase.jitter_q8) >> FILTER_SHIFT);
+    }
+
+    phase.statistics.locked     = phase.agreeing >= LOCK_SAMPLES;
+    calculated_phase_halfperiod = phase.filtered_q8 >> 8;
+}
+
+
+/*
+ * Drops the lock when the crossings stop
+ */
+void phase_check(int64_t now) {
+    uint32_t halfperiod = phase.filtered_q8 >> 8;
+    if (halfperiod > 0 && now - phase.last_crossing > (int64_t)halfperiod * TIMEOUT_HALFPERIODS) {
+        unlock();
+    }
+}
+
+
+uint8_t phase_is_locked(void) {
+    return phase.statistics.locked;
+}
+
+
+/*
+ * Predicted time of the first crossing after `now`, or 0 if the phase is not locked
+ */
+int64_t phase_next_crossing(int64_t now) {
+    uint32_t halfperiod = phase.filtered_q8 >> 8;
+    if (!phase.statistics.locked || halfperiod == 0) {
+        return 0;
+    }
+
+    int64_t next = phase.last_crossing + halfperiod;
+    if (next <= now) {
+        next += ((now - next) / halfperiod + 1) * halfperiod;
+    }
+    return next;
+}
+
+
+void phase_get_statistics(phase_statistics_t *result) {
+    *result               = phase.statistics;
+    result->halfperiod_us = phase.filtered_q8 >> 8;
+    result->jitter_us     = phase.jitter_q8 >> 8;
+}
+
+
+static void unlock(void) {
+    phase.filtered_q8           = 0;
+    phase.jitter_q8             = 0;
+    phase.agreeing              = 0;
+    phase.statistics.locked     = 0;
+    calculated_phase_halfperiod = 0;
+}
+
+
+static uint32_t deviation(uint32_t a, uint32_t b) {
+    return a > b ? a - b : b - a;
+}
@@ -0,0 +1,30 @@
+#ifndef PHASE_H_INCLUDED
+#define PHASE_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+typedef struct {
+    uint32_t halfperiod_us;     // Filtered
+    uint32_t jitter_us;         // Average deviation of the measured half periods from the filtered one
+    uint32_t max_jitter_us;
+    uint32_t rejected;          // Edges too close to the previous one, most likely noise
+    uint32_t missed;            // Crossings without an edge, inferred from a multiple of the half period
+    uint8_t  locked;
+} phase_statistics_t;
+
+
+extern volatile uint32_t calculated_phase_halfperiod;
+extern volatile uint32_t last_phase_halfperiod;
+
+
+void    phase_reset(void);
+void    phase_add_crossing(int64_t timestamp_us);
+void    phase_check(int64_t now_us);
+uint8_t phase_is_locked(void);
+int64_t phase_next_crossing(int64_t now_us);
+void    phase_get_statistics(phase_statistics_t *statistics);
+
+
+#endif
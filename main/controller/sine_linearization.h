@@ -0,0 +1,118 @@
+#ifndef SINE_LINEARIZATION_H_INCLUDED
+#define SINE_LINEARIZATION_H_INCLUDED
+
+// Generated by tools/sine_percentage_linearization.py, do not edit
+
+#include <stdint.h>
+
+
+#define SINE_PERCENTAGE_LINEARIZATION_PIECES  100
+#define SINE_PERCENTAGE_LINEARIZATION_MAXIMUM 10000
+
+
+static const uint16_t sine_percentage_linearization[SINE_PERCENTAGE_LINEARIZATION_PIECES + 1] = {
+    9999,
+    9361,
+    9095,
+    8890,
+    8716,
+    8563,
+    8423,
+    8294,
+    8173,
+    8058,
+    7950,
+    7846,
+    7746,
+    7650,
+    7556,
+    7466,
+    7378,
+    7292,
+    7208,
+    7126,
+    7046,
+    6967,
+    6889,
+    6813,
+    6738,
+    6664,
+    6591,
+    6519,
+    6447,
+    6377,
+    6307,
+    6238,
+    6169,
+    6101,
+    6034,
+    5967,
+    5900,
+    5834,
+    5768,
+    5703,
+    5638,
+    5573,
+    5508,
+    5444,
+    5380,
+    5315,
+    5252,
+    5188,
+    5124,
+    5060,
+    4996,
+    4933,
+    4869,
+    4805,
+    4741,
+    4677,
+    4613,
+    4549,
+    4485,
+    4420,
+    4355,
+    4290,
+    4225,
+    4159,
+    4093,
+    4026,
+    3959,
+    3892,
+    3824,
+    3755,
+    3686,
+    3616,
+    3546,
+    3474,
+    3402,
+    3329,
+    3255,
+    3180,
+    3104,
+    3026,
+    2947,
+    2867,
+    2785,
+    2701,
+    2615,
+    2527,
+    2437,
+    2343,
+    2247,
+    2147,
+    2043,
+    1935,
+    1820,
+    1699,
+    1570,
+    1430,
+    1276,
+    1103,
+    898,
+    632,
+    0,
+};
+
+
+#endif
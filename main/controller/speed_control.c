@@ -0,0 +1,101 @@
+#include <string.h>
+#include "speed_control.h"
+
+
+// Without pulses for this long the fan is considered stopped, that is below 30 rpm
+#define STALL_TIMEOUT_US 1000000LL
+
+#define Q16(x) ((int64_t)(x) << 16)
+
+
+static int64_t clamp(int64_t value, int64_t min, int64_t max);
+
+
+/*
+ * Measured speed from the pulse counter and the time of the last edge. The count is averaged over the edges
+ * seen since the previous call; without new edges the estimate can only decrease, down to 0 after a stall.
+ */
+uint16_t speed_tach_update(speed_tach_t *tach, uint32_t pulses, int64_t last_edge, int64_t now) {
+    if (!tach->primed) {
+        tach->pulses    = pulses;
+        tach->last_edge = last_edge;
+        tach->rpm       = 0;
+        tach->primed    = 1;
+        return 0;
+    }
+
+    uint32_t new_pulses = pulses - tach->pulses;
+    int64_t  elapsed    = last_edge - tach->last_edge;
+    uint64_t rpm        = 0;
+
+    if (new_pulses > 0 && elapsed > 0) {
+        rpm             = ((uint64_t)new_pulses * 60 * 1000000) / ((uint64_t)elapsed * TACH_PULSES_PER_REVOLUTION);
+        tach->pulses    = pulses;
+        tach->last_edge = last_edge;
+    } else if (now - tach->last_edge >= STALL_TIMEOUT_US) {
+        rpm = 0;
+    } else {
+        // The next edge is at least this far: the speed cannot be higher than that
+        int64_t  since = now - tach->last_edge;
+        uint64_t bound = since > 0 ? (60ULL * 1000000) / ((uint64_t)since * TACH_PULSES_PER_REVOLUTION) : UINT16_MAX;
+        rpm            = tach->rpm < bound ? tach->rpm : bound;
+    }
+
+    tach->rpm = rpm > UINT16_MAX ? UINT16_MAX : (uint16_t)rpm;
+    return tach->rpm;
+}
+
+
+void speed_pid_init(speed_pid_t *pid, int32_t kp, int32_t ki, int32_t kd, int32_t min, int32_t max) {
+    memset(pid, 0, sizeof(*pid));
+    pid->kp  = kp;
+    pid->ki  = ki;
+    pid->kd  = kd;
+    pid->min = min;
+    pid->max = max;
+}
+
+
+/*
+ * Restarts the controller so that its next output is `output`, for a bumpless switch from open loop
+ */
+void speed_pid_reset(speed_pid_t *pid, int32_t output, int32_t measurement) {
+    pid->integral = Q16(clamp(output, pid->min, pid->max));
+    pid->previous = measurement;
+}
+
+
+/*
+ * One step, to be called every SPEED_CONTROL_PERIOD_MS. The integral term stops growing while the output is
+ * saturated in the same direction (conditional integration), so it does not wind up at standstill or full speed.
+ */
+int32_t speed_pid_update(speed_pid_t *pid, int32_t setpoint, int32_t measurement) {
+    int32_t error = setpoint - measurement;
+
+    int64_t proportional = (int64_t)pid->kp * error;
+    int64_t derivative   = -(int64_t)pid->kd * (measurement - pid->previous);
+    int64_t integral     = clamp(pid->integral + (int64_t)pid->ki * error, Q16(pid->min), Q16(pid->max));
+    pid->previous        = measurement;
+
+    int64_t output = (proportional + integral + derivative + (1 << 15)) >> 16;
+
+    if ((output > pid->max && integral > pid->integral) || (output < pid->min && integral < pid->integral)) {
+        // Keep the previous integral
+        output = (proportional + pid->integral + derivative + (1 << 15)) >> 16;
+    } else {
+        pid->integral = integral;
+    }
+
+    return (int32_t)clamp(output, pid->min, pid->max);
+}
+
+
+static int64_t clamp(int64_t value, int64_t min, int64_t max) {
+    if (value < min) {
+        return min;
+    } else if (value > max) {
+        return max;
+    } else {
+        return value;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef SPEED_CONTROL_H_INCLUDED
+#define SPEED_CONTROL_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+#define SPEED_CONTROL_PERIOD_MS    50
+#define TACH_PULSES_PER_REVOLUTION 2
+
+// Duty permille per rpm of error, Q16; tuned on the simulator fan plant (2 s time constant)
+#define SPEED_PID_KP 6554     // 0.1
+#define SPEED_PID_KI 393      // 0.006 per period
+#define SPEED_PID_KD 0
+
+
+typedef struct {
+    uint32_t pulses;
+    int64_t  last_edge;
+    uint16_t rpm;
+    uint8_t  primed;
+} speed_tach_t;
+
+
+// Gains are in Q16 and already account for the control period
+typedef struct {
+    int32_t kp;
+    int32_t ki;
+    int32_t kd;
+    int32_t min;
+    int32_t max;
+    int64_t integral;     // Q16
+    int32_t previous;     // Last measurement, the derivative acts on it to avoid setpoint kicks
+} speed_pid_t;
+
+
+uint16_t speed_tach_update(speed_tach_t *tach, uint32_t pulses, int64_t last_edge_us, int64_t now_us);
+void     speed_pid_init(speed_pid_t *pid, int32_t kp, int32_t ki, int32_t kd, int32_t min, int32_t max);
+void     speed_pid_reset(speed_pid_t *pid, int32_t output, int32_t measurement);
+int32_t  speed_pid_update(speed_pid_t *pid, int32_t setpoint, int32_t measurement);
+
+
+#endif
@@ -0,0 +1,82 @@
+#include <string.h>
+#include <esp_rom_sys.h>
+#include "timing.h"
+
+
+typedef struct {
+    const char *name;
+    uint32_t    budget_us;
+} section_descriptor_t;
+
+
+static const section_descriptor_t sections[TIMING_SECTION_NUM] = {
+    [TIMING_SECTION_CONTROLLER] = {"Controller", 1000},
+    [TIMING_SECTION_MINION]     = {"Minion", 1000},
+    [TIMING_SECTION_REGISTER]   = {"Register", 50},
+    [TIMING_SECTION_JITTER]     = {"Jitter", 5000},
+};
+
+/*
+ *  Samples are only recorded from the controller task, so no locking is needed there; a reset requested from
+ *  elsewhere is applied by the next recording. Readers may see a sample half accounted, which is harmless.
+ */
+static timing_stats_t stats[TIMING_SECTION_NUM]   = {0};
+static uint32_t       budgets[TIMING_SECTION_NUM] = {0};
+static uint8_t        reset_requested             = 0;
+
+
+void timing_init(void) {
+    for (size_t i = 0; i < TIMING_SECTION_NUM; i++) {
+        budgets[i] = timing_us_to_cycles(sections[i].budget_us);
+    }
+}
+
+
+void timing_record(timing_section_t section, uint32_t cycles) {
+    if (__atomic_load_n(&reset_requested, __ATOMIC_RELAXED)) {
+        memset(stats, 0, sizeof(stats));
+        __atomic_store_n(&reset_requested, 0, __ATOMIC_RELAXED);
+    }
+
+    timing_stats_t *s = &stats[section];
+    // Position of the highest set bit
+    unsigned bucket = cycles > 0 ? 31 - __builtin_clz(cycles) : 0;
+    if (bucket >= TIMING_BUCKETS) {
+        bucket = TIMING_BUCKETS - 1;
+    }
+
+    s->count++;
+    s->total += cycles;
+    s->buckets[bucket]++;
+    if (cycles > s->max) {
+        s->max = cycles;
+    }
+    if (cycles > budgets[section]) {
+        s->misses++;
+    }
+}
+
+
+void timing_get(timing_section_t section, timing_stats_t *result) {
+    *result = stats[section];
+}
+
+
+void timing_reset(void) {
+    __atomic_store_n(&reset_requested, 1, __ATOMIC_RELAXED);
+}
+
+
+uint32_t timing_cycles_to_us(uint32_t cycles) {
+    return cycles / esp_rom_get_cpu_ticks_per_us();
+}
+
+
+uint32_t timing_us_to_cycles(uint32_t us) {
+    return us * esp_rom_get_cpu_ticks_per_us();
+}
+
+
+const char *timing_section_name(timing_section_t section) {
+    return sections[section].name;
+}
@@ -0,0 +1,50 @@
+#ifndef TIMING_H_INCLUDED
+#define TIMING_H_INCLUDED
+
+
+#include <stdint.h>
+#include "esp_cpu.h"
+
+
+// Bucket i counts durations between 2^i and 2^(i+1) - 1 CPU cycles; the last one takes everything longer
+#define TIMING_BUCKETS 24
+
+
+typedef enum {
+    TIMING_SECTION_CONTROLLER = 0,     // One controller_manage pass, excluding the wait
+    TIMING_SECTION_MINION,             // minion_manage
+    TIMING_SECTION_REGISTER,           // A single register_callback
+    TIMING_SECTION_JITTER,             // Deviation of the LED job from its nominal period
+    TIMING_SECTION_NUM,
+} timing_section_t;
+
+
+typedef struct {
+    uint32_t count;
+    uint32_t misses;     // Samples over the section budget
+    uint32_t max;        // Cycles
+    uint64_t total;      // Cycles
+    uint32_t buckets[TIMING_BUCKETS];
+} timing_stats_t;
+
+
+void        timing_init(void);
+void        timing_record(timing_section_t section, uint32_t cycles);
+void        timing_get(timing_section_t section, timing_stats_t *stats);
+void        timing_reset(void);
+uint32_t    timing_cycles_to_us(uint32_t cycles);
+uint32_t    timing_us_to_cycles(uint32_t us);
+const char *timing_section_name(timing_section_t section);
+
+
+static inline __attribute__((always_inline)) uint32_t timing_start(void) {
+    return esp_cpu_get_cycle_count();
+}
+
+
+static inline __attribute__((always_inline)) void timing_stop(timing_section_t section, uint32_t start) {
+    timing_record(section, esp_cpu_get_cycle_count() - start);
+}
+
+
+#endif
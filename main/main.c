@@ -5,16 +5,28 @@
 #include "freertos/task.h"
 #include "freertos/timers.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include <esp_vfs_dev.h>
 #include "driver/uart.h"
 #include "controller/minion.h"
 #include "model/model.h"
 #include "controller/controller.h"
+#include "controller/event_log.h"
+#include "controller/config_writer.h"
 #include "peripherals/system.h"
 #include "peripherals/rs485.h"
 #include "peripherals/heartbeat.h"
+#include "peripherals/outputs.h"
 #include "peripherals/storage.h"
 #include "peripherals/digin.h"
+#include "peripherals/tach.h"
+
+
+// Pending configuration writes get this long to reach the flash before a restart
+#define SHUTDOWN_FLUSH_TIMEOUT_MS 500
+
+
+static void shutdown_handler(void);
 
 
 static const char *TAG = "Main";
@@ -24,16 +36,29 @@ void app_main(void) {
 
     system_random_init();
     digin_init();
+    tach_init();
     rs485_init();
+    outputs_init();
     heartbeat_init();
     storage_init();
 
     model_init(&model);
     controller_init(&model);
+    event_log_add(EVENT_LOG_CODE_RESET, esp_reset_reason());
+    ESP_ERROR_CHECK(esp_register_shutdown_handler(shutdown_handler));
+    // From here on the heap should not be touched anymore
+    system_heap_watch_start();
 
     ESP_LOGI(TAG, "Begin main loop");
     for (;;) {
+        // Paced by controller_manage, which waits for model changes and incoming frames
         controller_manage(&model);
-        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+}
+
+
+static void shutdown_handler(void) {
+    if (config_writer_flush(SHUTDOWN_FLUSH_TIMEOUT_MS)) {
+        ESP_LOGW(TAG, "Configuration writes still pending at shutdown");
     }
 }
@@ -5,12 +5,42 @@
 #include "config/app_config.h"
 
 
+/*
+ *  Runs `statement` until it completes without overlapping a multi-field write. After a few attempts the reader
+ *  takes the writer lock instead of spinning, so that a preempted lower priority writer is allowed to finish.
+ */
+#define SEQLOCK_READ(pmodel, statement)                                                                                \
+    for (unsigned attempt = 0;; attempt++) {                                                                           \
+        if (attempt == SEQLOCK_READ_ATTEMPTS) {                                                                        \
+            xSemaphoreTake((pmodel)->sem, portMAX_DELAY);                                                              \
+            statement;                                                                                                 \
+            xSemaphoreGive((pmodel)->sem);                                                                             \
+            break;                                                                                                     \
+        }                                                                                                              \
+        uint32_t sequence = __atomic_load_n(&(pmodel)->sequence, __ATOMIC_ACQUIRE);                                    \
+        if ((sequence & 1) == 0) {                                                                                     \
+            statement;                                                                                                 \
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);                                                                   \
+            if (__atomic_load_n(&(pmodel)->sequence, __ATOMIC_RELAXED) == sequence) {                                  \
+                break;                                                                                                 \
+            }                                                                                                          \
+        }                                                                                                              \
+    }
+
+#define SEQLOCK_READ_ATTEMPTS 4
+
+
 static uint8_t valid_mode(uint16_t mode);
+static void    copy_snapshot(model_t *pmodel, model_snapshot_t *snapshot);
+static void    write_begin(model_t *pmodel);
+static void    write_end(model_t *pmodel);
 
 
 void model_init(model_t *pmodel) {
     assert(pmodel != NULL);
-    pmodel->sem = xSemaphoreCreateMutexStatic(&pmodel->semaphore_buffer);
+    pmodel->sem      = xSemaphoreCreateMutexStatic(&pmodel->semaphore_buffer);
+    pmodel->sequence = 0;
+    pmodel->observer = NULL;
 
     pmodel->address       = EASYCONNECT_DEFAULT_MINION_ADDRESS;
     pmodel->serial_number = EASYCONNECT_DEFAULT_MINION_SERIAL_NUMBER;
@@ -18,10 +48,21 @@ void model_init(model_t *pmodel) {
     pmodel->class = EASYCONNECT_DEFAULT_DEVICE_CLASS;
 
     pmodel->motor_active      = 0;
-    pmodel->speed_percentage  = 0;
+    pmodel->speed_permille    = 0;
     pmodel->missing_heartbeat = 0;
     pmodel->safety_bypass     = 0;
 
+    pmodel->baudrate = DEFAULT_BAUDRATE;
+    pmodel->parity   = DEFAULT_PARITY;
+
+    pmodel->acceleration = DEFAULT_ACCELERATION;
+    pmodel->deceleration = DEFAULT_DECELERATION;
+    pmodel->ramp_profile = DEFAULT_RAMP_PROFILE;
+
+    pmodel->speed_mode   = SPEED_MODE_OPEN_LOOP;
+    pmodel->max_rpm      = DEFAULT_MAX_RPM;
+    pmodel->measured_rpm = 0;
+
     memset(pmodel->safety_message, 0, sizeof(pmodel->safety_message));
 }
 
@@ -33,6 +74,22 @@ void model_check_values(model_t *pmodel) {
     if (class != CLASS(DEVICE_MODE_FAN, DEVICE_GROUP_1) && class != CLASS(DEVICE_MODE_FAN, DEVICE_GROUP_2)) {
         model_set_class(pmodel, EASYCONNECT_DEFAULT_DEVICE_CLASS, NULL);
     }
+
+    if (model_get_acceleration(pmodel) > MAX_RAMP_RATE) {
+        model_set_acceleration(pmodel, DEFAULT_ACCELERATION);
+    }
+    if (model_get_deceleration(pmodel) > MAX_RAMP_RATE) {
+        model_set_deceleration(pmodel, DEFAULT_DECELERATION);
+    }
+    if (model_get_ramp_profile(pmodel) > RAMP_PROFILE_S_CURVE) {
+        model_set_ramp_profile(pmodel, DEFAULT_RAMP_PROFILE);
+    }
+    if (model_get_speed_mode(pmodel) > SPEED_MODE_CLOSED_LOOP) {
+        model_set_speed_mode(pmodel, SPEED_MODE_OPEN_LOOP);
+    }
+    if (model_get_max_rpm(pmodel) < MIN_MAX_RPM || model_get_max_rpm(pmodel) > MAX_MAX_RPM) {
+        model_set_max_rpm(pmodel, DEFAULT_MAX_RPM);
+    }
 }
 
 
@@ -40,11 +97,8 @@ uint16_t model_get_class(void *arg) {
     assert(arg != NULL);
     model_t *pmodel = arg;
 
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-    uint16_t result = (pmodel->class & CLASS_CONFIGURABLE_MASK) | (APP_CONFIG_HARDWARE_MODEL << 12);
-    xSemaphoreGive(pmodel->sem);
-
-    return result;
+    uint16_t class = __atomic_load_n(&pmodel->class, __ATOMIC_ACQUIRE);
+    return (class & CLASS_CONFIGURABLE_MASK) | (APP_CONFIG_HARDWARE_MODEL << 12);
 }
 
 
@@ -59,9 +113,10 @@ int model_set_class(void *arg, uint16_t class, uint16_t *out_class) {
         if (out_class != NULL) {
             *out_class = corrected;
         }
-        xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-        pmodel->class = corrected;
-        xSemaphoreGive(pmodel->sem);
+        write_begin(pmodel);
+        __atomic_store_n(&pmodel->class, corrected, __ATOMIC_RELAXED);
+        write_end(pmodel);
+        model_notify(pmodel, MODEL_CHANGE_CLASS);
         return 0;
     } else {
         return -1;
@@ -71,19 +126,91 @@ int model_set_class(void *arg, uint16_t class, uint16_t *out_class) {
 
 void model_get_safety_message(void *args, char *string) {
     model_t *pmodel = args;
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
-    strcpy(string, pmodel->safety_message);
-    xSemaphoreGive(pmodel->sem);
+    char     safety_message[sizeof(pmodel->safety_message)];
+
+    SEQLOCK_READ(pmodel, memcpy(safety_message, pmodel->safety_message, sizeof(safety_message)));
+    // The last byte is always 0, so even a torn copy is terminated
+    strcpy(string, safety_message);
 }
 
 
 void model_set_safety_message(model_t *pmodel, const char *string) {
-    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
+    write_begin(pmodel);
+    // Snapshots copy the whole buffer: nothing of a longer previous message may survive past the terminator
+    memset(pmodel->safety_message, 0, sizeof(pmodel->safety_message));
     snprintf(pmodel->safety_message, sizeof(pmodel->safety_message), "%s", string);
-    xSemaphoreGive(pmodel->sem);
+    write_end(pmodel);
+    model_notify(pmodel, MODEL_CHANGE_SAFETY_MESSAGE);
+}
+
+
+void model_set_fan_state(model_t *pmodel, uint16_t speed_permille, uint8_t motor_active, uint8_t safety_bypass) {
+    assert(pmodel != NULL);
+
+    uint32_t changes = 0;
+
+    write_begin(pmodel);
+    changes |= pmodel->speed_permille != speed_permille ? MODEL_CHANGE_SPEED : 0;
+    changes |= pmodel->motor_active != motor_active ? MODEL_CHANGE_MOTOR_ACTIVE : 0;
+    changes |= pmodel->safety_bypass != safety_bypass ? MODEL_CHANGE_SAFETY_BYPASS : 0;
+    __atomic_store_n(&pmodel->speed_permille, speed_permille, __ATOMIC_RELAXED);
+    __atomic_store_n(&pmodel->motor_active, motor_active, __ATOMIC_RELAXED);
+    __atomic_store_n(&pmodel->safety_bypass, safety_bypass, __ATOMIC_RELAXED);
+    write_end(pmodel);
+
+    if (changes) {
+        model_notify(pmodel, changes);
+    }
+}
+
+
+/*
+ * Sets the task to be notified of model changes, with the MODEL_CHANGE_* bits
+ */
+void model_set_observer(model_t *pmodel, TaskHandle_t task) {
+    assert(pmodel != NULL);
+    __atomic_store_n(&pmodel->observer, task, __ATOMIC_RELEASE);
+}
+
+
+void model_take_snapshot(model_t *pmodel, model_snapshot_t *snapshot) {
+    assert(pmodel != NULL && snapshot != NULL);
+
+    SEQLOCK_READ(pmodel, copy_snapshot(pmodel, snapshot));
+}
+
+
+static void copy_snapshot(model_t *pmodel, model_snapshot_t *snapshot) {
+    snapshot->address           = model_get_address(pmodel);
+    snapshot->serial_number     = model_get_serial_number(pmodel);
+    snapshot->class             = model_get_class(pmodel);
+    snapshot->missing_heartbeat = model_get_missing_heartbeat(pmodel);
+    snapshot->motor_active      = model_get_motor_active(pmodel);
+    snapshot->speed_permille    = model_get_speed_permille(pmodel);
+    snapshot->speed_percentage  = snapshot->speed_permille / 10;
+    snapshot->safety_bypass     = model_get_safety_bypass(pmodel);
+    snapshot->acceleration      = model_get_acceleration(pmodel);
+    snapshot->deceleration      = model_get_deceleration(pmodel);
+    snapshot->ramp_profile      = model_get_ramp_profile(pmodel);
+    snapshot->speed_mode        = model_get_speed_mode(pmodel);
+    snapshot->max_rpm           = model_get_max_rpm(pmodel);
+    snapshot->measured_rpm      = model_get_measured_rpm(pmodel);
+    memcpy(snapshot->safety_message, pmodel->safety_message, sizeof(snapshot->safety_message));
+}
+
+
+static void write_begin(model_t *pmodel) {
+    xSemaphoreTake(pmodel->sem, portMAX_DELAY);
+    __atomic_store_n(&pmodel->sequence, pmodel->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 }
 
 
+static void write_end(model_t *pmodel) {
+    __atomic_store_n(&pmodel->sequence, pmodel->sequence + 1, __ATOMIC_RELEASE);
+    xSemaphoreGive(pmodel->sem);
+}
+
 
 static uint8_t valid_mode(uint16_t mode) {
     switch (mode) {
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "easyconnect_interface.h"
 
 
@@ -13,6 +14,18 @@
 
 #define EASYCONNECT_DEFAULT_DEVICE_CLASS CLASS(DEVICE_MODE_FAN, DEVICE_GROUP_1)
 
+#define DEFAULT_BAUDRATE 115200
+#define DEFAULT_PARITY   0
+
+#define DEFAULT_ACCELERATION 50      // %/s
+#define DEFAULT_DECELERATION 100     // %/s
+#define DEFAULT_RAMP_PROFILE RAMP_PROFILE_LINEAR
+#define MAX_RAMP_RATE        1000
+
+#define DEFAULT_MAX_RPM 3000
+#define MIN_MAX_RPM     100
+#define MAX_MAX_RPM     20000
+
 #define NUM_SPEED_STEPS 5
 
 #define GETTER_UNSAFE(name, field)                                                                                     \
@@ -28,39 +41,50 @@
         pmodel->field = value;                                                                                         \
     }
 
+/*
+ *  Scalar fields are read and written atomically without locking; fields that must change together go through
+ *  the sequence lock in model.c instead.
+ */
 #define GETTER(type, name, field)                                                                                      \
     static inline __attribute__((always_inline)) typeof(((model_t *)0)->field) model_get_##name(type *arg) {           \
         model_t *pmodel = arg;                                                                                         \
         assert(pmodel != NULL);                                                                                        \
-        xSemaphoreTake(pmodel->sem, portMAX_DELAY);                                                                    \
-        typeof(((model_t *)0)->field) res = pmodel->field;                                                             \
-        xSemaphoreGive(pmodel->sem);                                                                                   \
-        return res;                                                                                                    \
+        return __atomic_load_n(&pmodel->field, __ATOMIC_ACQUIRE);                                                      \
     }
 
-#define SETTER(type, name, field)                                                                                      \
+#define SETTER(type, name, field, change)                                                                              \
     static inline                                                                                                      \
         __attribute__((always_inline)) void model_set_##name(type *arg, typeof(((model_t *)0)->field) value) {         \
         model_t *pmodel = arg;                                                                                         \
         assert(pmodel != NULL);                                                                                        \
-        xSemaphoreTake(pmodel->sem, portMAX_DELAY);                                                                    \
-        pmodel->field = value;                                                                                         \
-        xSemaphoreGive(pmodel->sem);                                                                                   \
+        if (__atomic_load_n(&pmodel->field, __ATOMIC_RELAXED) != value) {                                              \
+            __atomic_store_n(&pmodel->field, value, __ATOMIC_RELEASE);                                                 \
+            model_notify(pmodel, change);                                                                              \
+        }                                                                                                              \
+    }
+
+// For measurements: nobody needs to be woken up when they change
+#define SETTER_QUIET(type, name, field)                                                                                \
+    static inline                                                                                                      \
+        __attribute__((always_inline)) void model_set_##name(type *arg, typeof(((model_t *)0)->field) value) {         \
+        model_t *pmodel = arg;                                                                                         \
+        assert(pmodel != NULL);                                                                                        \
+        __atomic_store_n(&pmodel->field, value, __ATOMIC_RELEASE);                                                     \
     }
 
-#define GETTER_GENERIC(name, field) GETTER(void, name, field)
-#define SETTER_GENERIC(name, field) SETTER(void, name, field)
+#define GETTER_GENERIC(name, field)         GETTER(void, name, field)
+#define SETTER_GENERIC(name, field, change) SETTER(void, name, field, change)
 
-#define GETTER_MODEL(name, field) GETTER(model_t, name, field)
-#define SETTER_MODEL(name, field) SETTER(model_t, name, field)
+#define GETTER_MODEL(name, field)         GETTER(model_t, name, field)
+#define SETTER_MODEL(name, field, change) SETTER(model_t, name, field, change)
 
-#define GETTERNSETTER_GENERIC(name, field)                                                                             \
+#define GETTERNSETTER_GENERIC(name, field, change)                                                                     \
     GETTER_GENERIC(name, field)                                                                                        \
-    SETTER_GENERIC(name, field)
+    SETTER_GENERIC(name, field, change)
 
-#define GETTERNSETTER(name, field)                                                                                     \
+#define GETTERNSETTER(name, field, change)                                                                             \
     GETTER_MODEL(name, field)                                                                                          \
-    SETTER_MODEL(name, field)
+    SETTER_MODEL(name, field, change)
 
 #define GETTERNSETTER_UNSAFE(name, field)                                                                              \
     GETTER_UNSAFE(name, field)                                                                                         \
@@ -68,9 +92,44 @@
 
 
 
+/*
+ *  Change notification bits, set on the observer task with `xTaskNotify` whenever the field actually changes.
+ *  Bits from MODEL_CHANGE_RESERVED up are left to the observer for its own events.
+ */
+typedef enum {
+    MODEL_CHANGE_ADDRESS           = 0x0001,
+    MODEL_CHANGE_SERIAL_NUMBER     = 0x0002,
+    MODEL_CHANGE_CLASS             = 0x0004,
+    MODEL_CHANGE_SAFETY_MESSAGE    = 0x0008,
+    MODEL_CHANGE_MISSING_HEARTBEAT = 0x0010,
+    MODEL_CHANGE_MOTOR_ACTIVE      = 0x0020,
+    MODEL_CHANGE_SPEED             = 0x0040,
+    MODEL_CHANGE_SAFETY_BYPASS     = 0x0080,
+    MODEL_CHANGE_BAUDRATE          = 0x0100,
+    MODEL_CHANGE_PARITY            = 0x0200,
+    MODEL_CHANGE_RAMP              = 0x0400,
+    MODEL_CHANGE_SPEED_CONTROL     = 0x0800,
+    MODEL_CHANGE_RESERVED          = 0x10000,
+} model_change_t;
+
+
+typedef enum {
+    RAMP_PROFILE_LINEAR = 0,
+    RAMP_PROFILE_S_CURVE,
+} ramp_profile_t;
+
+
+typedef enum {
+    SPEED_MODE_OPEN_LOOP = 0,     // The speed sets the duty
+    SPEED_MODE_CLOSED_LOOP,       // The speed sets the target rpm, as a fraction of max_rpm
+} speed_mode_t;
+
+
 typedef struct {
     StaticSemaphore_t semaphore_buffer;
-    SemaphoreHandle_t sem;
+    SemaphoreHandle_t sem;          // Serializes multi-field writers
+    uint32_t          sequence;     // Odd while a multi-field write is in progress
+    TaskHandle_t      observer;     // Notified of every change, if set
 
     uint16_t address;
     uint32_t serial_number;
@@ -78,24 +137,90 @@ typedef struct {
 
     char    safety_message[EASYCONNECT_MESSAGE_SIZE + 1];
     uint8_t missing_heartbeat;
-    uint8_t motor_active;
-    uint8_t speed_percentage;
-    uint8_t safety_bypass;
+    uint8_t  motor_active;
+    uint16_t speed_permille;
+    uint8_t  safety_bypass;
+
+    uint32_t baudrate;
+    uint8_t  parity;
+
+    uint16_t acceleration;     // %/s, 0 for immediate changes
+    uint16_t deceleration;     // %/s, 0 for immediate changes
+    uint8_t  ramp_profile;
+
+    uint8_t  speed_mode;
+    uint16_t max_rpm;
+    uint16_t measured_rpm;
 } model_t;
 
 
+// Consistent copy of the model state
+typedef struct {
+    uint16_t address;
+    uint32_t serial_number;
+    uint16_t class;
+
+    char    safety_message[EASYCONNECT_MESSAGE_SIZE + 1];
+    uint8_t missing_heartbeat;
+    uint8_t  motor_active;
+    uint8_t  speed_percentage;
+    uint16_t speed_permille;
+    uint8_t  safety_bypass;
+
+    uint16_t acceleration;
+    uint16_t deceleration;
+    uint8_t  ramp_profile;
+
+    uint8_t  speed_mode;
+    uint16_t max_rpm;
+    uint16_t measured_rpm;
+} model_snapshot_t;
+
+
 void     model_init(model_t *model);
 void     model_check_values(model_t *pmodel);
 uint16_t model_get_class(void *arg);
 int      model_set_class(void *arg, uint16_t class, uint16_t *out_class);
 void     model_get_safety_message(void *args, char *string);
 void     model_set_safety_message(model_t *pmodel, const char *string);
+void     model_take_snapshot(model_t *pmodel, model_snapshot_t *snapshot);
+void     model_set_fan_state(model_t *pmodel, uint16_t speed_permille, uint8_t motor_active, uint8_t safety_bypass);
+void     model_set_observer(model_t *pmodel, TaskHandle_t task);
 
-GETTERNSETTER_GENERIC(address, address);
-GETTERNSETTER_GENERIC(serial_number, serial_number);
-GETTERNSETTER_GENERIC(missing_heartbeat, missing_heartbeat);
-GETTERNSETTER(speed_percentage, speed_percentage);
-GETTERNSETTER(motor_active, motor_active);
-GETTERNSETTER(safety_bypass, safety_bypass);
+
+static inline __attribute__((always_inline)) void model_notify(model_t *pmodel, uint32_t changes) {
+    TaskHandle_t observer = __atomic_load_n(&pmodel->observer, __ATOMIC_ACQUIRE);
+    if (observer != NULL) {
+        xTaskNotify(observer, changes, eSetBits);
+    }
+}
+
+
+GETTERNSETTER_GENERIC(address, address, MODEL_CHANGE_ADDRESS);
+GETTERNSETTER_GENERIC(serial_number, serial_number, MODEL_CHANGE_SERIAL_NUMBER);
+GETTERNSETTER_GENERIC(missing_heartbeat, missing_heartbeat, MODEL_CHANGE_MISSING_HEARTBEAT);
+GETTERNSETTER(speed_permille, speed_permille, MODEL_CHANGE_SPEED);
+GETTERNSETTER(motor_active, motor_active, MODEL_CHANGE_MOTOR_ACTIVE);
+GETTERNSETTER(safety_bypass, safety_bypass, MODEL_CHANGE_SAFETY_BYPASS);
+GETTERNSETTER(baudrate, baudrate, MODEL_CHANGE_BAUDRATE);
+GETTERNSETTER(parity, parity, MODEL_CHANGE_PARITY);
+GETTERNSETTER(acceleration, acceleration, MODEL_CHANGE_RAMP);
+GETTERNSETTER(deceleration, deceleration, MODEL_CHANGE_RAMP);
+GETTERNSETTER(ramp_profile, ramp_profile, MODEL_CHANGE_RAMP);
+GETTERNSETTER(speed_mode, speed_mode, MODEL_CHANGE_SPEED_CONTROL);
+GETTERNSETTER(max_rpm, max_rpm, MODEL_CHANGE_SPEED_CONTROL);
+GETTER_MODEL(measured_rpm, measured_rpm);
+SETTER_QUIET(model_t, measured_rpm, measured_rpm);
+
+
+// The speed is kept in 0.1% steps
+static inline __attribute__((always_inline)) uint8_t model_get_speed_percentage(model_t *pmodel) {
+    return model_get_speed_permille(pmodel) / 10;
+}
+
+
+static inline __attribute__((always_inline)) void model_set_speed_percentage(model_t *pmodel, uint8_t value) {
+    model_set_speed_permille(pmodel, value * 10);
+}
 
 #endif
@@ -21,6 +21,9 @@
 static debounce_filter_t  filter;
 static SemaphoreHandle_t  sem;
 static EventGroupHandle_t events;
+// Task to wake up when the debounced inputs change, with its notification bits
+static TaskHandle_t notify_task = NULL;
+static uint32_t     notify_bits = 0;
 
 
 static void periodic_read(TimerHandle_t timer);
@@ -77,11 +80,25 @@ uint8_t digin_is_value_ready(void) {
 }
 
 
+/*
+ * Sets a task to be notified (with `xTaskNotify`, setting `bits`) whenever the debounced inputs change
+ */
+void digin_set_notification(TaskHandle_t task, uint32_t bits) {
+    notify_bits = bits;
+    __atomic_store_n(&notify_task, task, __ATOMIC_RELEASE);
+}
+
+
 static void periodic_read(TimerHandle_t timer) {
     (void)timer;
     xSemaphoreTake(sem, portMAX_DELAY);
     if (digin_take_reading()) {
         xEventGroupSetBits(events, EVENT_NEW_INPUT);
+
+        TaskHandle_t task = __atomic_load_n(&notify_task, __ATOMIC_ACQUIRE);
+        if (task != NULL) {
+            xTaskNotify(task, notify_bits, eSetBits);
+        }
     }
     xSemaphoreGive(sem);
 }
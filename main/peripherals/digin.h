@@ -4,6 +4,8 @@
 #include "hal/gpio_types.h"
 #include <string.h>
 #include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 typedef enum {
     DIGIN_SAFETY = 0,
@@ -14,5 +16,6 @@ int          digin_get(digin_t digin);
 int          digin_take_reading(void);
 unsigned int digin_get_inputs(void);
 uint8_t      digin_is_value_ready(void);
+void         digin_set_notification(TaskHandle_t task, uint32_t bits);
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define HARDWAREPROFILE_H_INCLUDED
 
 #include <driver/gpio.h>
+#include <driver/ledc.h>
 
 /*
  * Definizioni dei pin da utilizzare
@@ -16,5 +17,17 @@
 #define HAP_OUTPUT  GPIO_NUM_3
 #define HAP_PWM     GPIO_NUM_2
 #define HAP_INPUT   GPIO_NUM_10
+// Mains zero-cross detector, one pulse per crossing
+#define HAP_ZERO_CROSS GPIO_NUM_4
+// Fan tachometer, open collector
+#define HAP_TACH GPIO_NUM_5
+
+// All GPIO interrupts share one source: the ISR service and the trip handler are allocated on it side by side
+#define HAP_GPIO_INTR_FLAGS (ESP_INTR_FLAG_IRAM | ESP_INTR_FLAG_SHARED)
+
+// LEDC channel driving HAP_PWM
+#define HAP_PWM_MODE    LEDC_LOW_SPEED_MODE
+#define HAP_PWM_CHANNEL LEDC_CHANNEL_0
+#define HAP_PWM_TIMER   LEDC_TIMER_1
 
 #endif
\ No newline at end of file
@@ -6,6 +6,7 @@
 
 #include "hardwareprofile.h"
 #include "heartbeat.h"
+#include "outputs.h"
 
 
 static const char *TAG = "Heartbeat";
@@ -17,10 +18,10 @@ void heartbeat_init(void) {
 
 
 void heartbeat_update_green(uint8_t value) {
-    gpio_set_level(IO_LED_GREEN, !value);
+    outputs_set(OUTPUT_LED_GREEN, !value);
 }
 
 
 void heartbeat_update_red(uint8_t value) {
-    gpio_set_level(IO_LED_RED, !value);
+    outputs_set(OUTPUT_LED_RED, !value);
 }
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include <string.h>
+#include <driver/gpio.h>
+#include <driver/ledc.h>
+#include <hal/gpio_ll.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "hardwareprofile.h"
+#include "outputs.h"
+
+
+static uint8_t update_shadow(output_t output, uint32_t value);
+static void    write_output(output_t output, uint32_t value);
+
+
+static const char *TAG = "Outputs";
+
+static const char *names[OUTPUT_NUM] = {
+    [OUTPUT_HAP]       = "HAP",
+    [OUTPUT_PWM]       = "PWM",
+    [OUTPUT_LED_GREEN] = "Green LED",
+    [OUTPUT_LED_RED]   = "Red LED",
+};
+
+/*
+ *  Last value written to each output. The GPIO channels are compared and written inside a critical section (the
+ *  trip drives HAP_OUTPUT from one), the LEDC driver may block so the duty is serialized with a mutex instead.
+ *  An output whose hardware state was changed elsewhere is invalidated and written again on the next set.
+ */
+static portMUX_TYPE         lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t    pwm_mutex;
+static StaticSemaphore_t    pwm_mutex_buffer;
+static uint32_t             shadow[OUTPUT_NUM]     = {0};
+static uint8_t              valid[OUTPUT_NUM]      = {0};
+static outputs_statistics_t statistics[OUTPUT_NUM] = {0};
+
+
+void outputs_init(void) {
+    pwm_mutex = xSemaphoreCreateMutexStatic(&pwm_mutex_buffer);
+    ESP_LOGI(TAG, "Initialized");
+}
+
+
+/*
+ * Writes `value` to the output unless it already has it; returns 1 if the hardware was written
+ */
+uint8_t outputs_set(output_t output, uint32_t value) {
+    uint8_t changed = 0;
+
+    if (output == OUTPUT_PWM) {
+        xSemaphoreTake(pwm_mutex, portMAX_DELAY);
+        changed = update_shadow(output, value);
+        if (changed) {
+            write_output(output, value);
+        }
+        xSemaphoreGive(pwm_mutex);
+    } else {
+        portENTER_CRITICAL(&lock);
+        changed = update_shadow(output, value);
+        if (changed) {
+            write_output(output, value);
+        }
+        portEXIT_CRITICAL(&lock);
+    }
+
+    return changed;
+}
+
+
+/*
+ * The hardware state was changed behind the driver's back (the trip interrupt, a LEDC fade); safe from interrupts
+ */
+void IRAM_ATTR outputs_invalidate(output_t output) {
+    __atomic_store_n(&valid[output], 0, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Counters are read under the same lock they are updated with
+ */
+void outputs_get_statistics(output_t output, outputs_statistics_t *result) {
+    if (output == OUTPUT_PWM) {
+        xSemaphoreTake(pwm_mutex, portMAX_DELAY);
+        *result = statistics[output];
+        xSemaphoreGive(pwm_mutex);
+    } else {
+        portENTER_CRITICAL(&lock);
+        *result = statistics[output];
+        portEXIT_CRITICAL(&lock);
+    }
+}
+
+
+void outputs_reset_statistics(void) {
+    // The mutex first: it cannot be taken inside the critical section
+    xSemaphoreTake(pwm_mutex, portMAX_DELAY);
+    portENTER_CRITICAL(&lock);
+    memset(statistics, 0, sizeof(statistics));
+    portEXIT_CRITICAL(&lock);
+    xSemaphoreGive(pwm_mutex);
+}
+
+
+const char *outputs_name(output_t output) {
+    return names[output];
+}
+
+
+static uint8_t update_shadow(output_t output, uint32_t value) {
+    if (__atomic_load_n(&valid[output], __ATOMIC_ACQUIRE) && shadow[output] == value) {
+        statistics[output].suppressed++;
+        return 0;
+    }
+
+    shadow[output] = value;
+    __atomic_store_n(&valid[output], 1, __ATOMIC_RELEASE);
+    statistics[output].written++;
+    return 1;
+}
+
+
+static void write_output(output_t output, uint32_t value) {
+    switch (output) {
+        case OUTPUT_HAP:
+            gpio_ll_set_level(&GPIO, HAP_OUTPUT, value);
+            break;
+
+        case OUTPUT_PWM:
+            ledc_set_duty_and_update(HAP_PWM_MODE, HAP_PWM_CHANNEL, value, 0);
+            break;
+
+        case OUTPUT_LED_GREEN:
+            gpio_set_level(IO_LED_GREEN, value);
+            break;
+
+        case OUTPUT_LED_RED:
+            gpio_set_level(IO_LED_RED, value);
+            break;
+
+        default:
+            break;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef OUTPUTS_H_INCLUDED
+#define OUTPUTS_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+typedef enum {
+    OUTPUT_HAP = 0,
+    OUTPUT_PWM,     // LEDC duty on HAP_PWM
+    OUTPUT_LED_GREEN,
+    OUTPUT_LED_RED,
+    OUTPUT_NUM,
+} output_t;
+
+
+typedef struct {
+    uint32_t written;
+    uint32_t suppressed;     // Writes skipped because the output already had that value
+} outputs_statistics_t;
+
+
+void        outputs_init(void);
+uint8_t     outputs_set(output_t output, uint32_t value);
+void        outputs_invalidate(output_t output);
+void        outputs_get_statistics(output_t output, outputs_statistics_t *statistics);
+void        outputs_reset_statistics(void);
+const char *outputs_name(output_t output);
+
+
+#endif
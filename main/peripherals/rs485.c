@@ -1,18 +1,48 @@
+#include <string.h>
 #include <driver/gpio.h>
 #include <driver/uart.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "app_config.h"
 #include "hardwareprofile.h"
+#include "rtu_framer.h"
+#include "rs485.h"
 
 
 #define MB_PORTNUM UART_NUM_1
-// Timeout threshold for UART = number of symbols (~10 tics) with unchanged
-// state on receive pin
-#define ECHO_READ_TOUT (3)     // 3.5T * 8 = 28 ticks, TOUT=3 -> ~24..33 ticks
-#define MODBUS_TIMEOUT 10
+// Modbus RTU silence between frames: 3.5 characters, fixed at 1.75 ms above 19200 baud
+#define FRAME_GAP_HALF_CHARACTERS 7
+#define FRAME_GAP_FIXED_BAUDRATE  19200
+#define FRAME_GAP_FIXED_NS        1750000ULL
+// Timeout threshold for UART = number of symbols with unchanged state on receive pin
+#define MAX_RX_TOUT        90
+#define TX_DONE_TIMEOUT_MS 100
+
+#define UART_EVENT_QUEUE_SIZE 10
+#define FRAME_QUEUE_SIZE      4
+
+
+static void    rs485_task(void *args);
+static void    send_frame(rtu_framer_t *framer);
+static uint8_t rx_timeout_symbols(uint32_t baudrate, rs485_parity_t parity);
+
+
+static const char   *TAG = "RS485";
+static QueueHandle_t uart_queue;
+static QueueHandle_t frame_queue;
+static rtu_framer_t  framer;
+static uint32_t      overruns = 0;
+// Task to wake up when a frame is queued, with its notification bits
+static TaskHandle_t notify_task = NULL;
+static uint32_t     notify_bits = 0;
 
 
 void rs485_init(void) {
     uart_config_t uart_config = {
-        .baud_rate           = 115200,
+        .baud_rate           = RS485_DEFAULT_BAUDRATE,
         .data_bits           = UART_DATA_8_BITS,
         .parity              = UART_PARITY_DISABLE,
         .stop_bits           = UART_STOP_BITS_1,
@@ -21,19 +51,42 @@ void rs485_init(void) {
         .source_clk          = UART_SCLK_DEFAULT,
     };
 
-    ESP_ERROR_CHECK(uart_driver_install(MB_PORTNUM, 256, 256, 10, NULL, 0));
+    rtu_framer_init(&framer);
+
+    ESP_ERROR_CHECK(uart_driver_install(MB_PORTNUM, 256, 256, UART_EVENT_QUEUE_SIZE, &uart_queue, 0));
 
     // Configure UART parameters
     ESP_ERROR_CHECK(uart_param_config(MB_PORTNUM, &uart_config));
 
     ESP_ERROR_CHECK(uart_set_pin(MB_PORTNUM, MB_UART_TXD, MB_UART_RXD, MB_DERE, -1));
     ESP_ERROR_CHECK(uart_set_mode(MB_PORTNUM, UART_MODE_RS485_HALF_DUPLEX));
-    ESP_ERROR_CHECK(uart_set_rx_timeout(MB_PORTNUM, ECHO_READ_TOUT));
+    ESP_ERROR_CHECK(uart_set_rx_timeout(MB_PORTNUM, rx_timeout_symbols(RS485_DEFAULT_BAUDRATE, RS485_PARITY_NONE)));
+
+    static StaticQueue_t queue_buffer;
+    static uint8_t       queue_storage[FRAME_QUEUE_SIZE * sizeof(rs485_frame_t)];
+    frame_queue = xQueueCreateStatic(FRAME_QUEUE_SIZE, sizeof(rs485_frame_t), queue_storage, &queue_buffer);
+
+    static uint8_t      stack_buffer[APP_CONFIG_BASE_TASK_STACK_SIZE * 4];
+    static StaticTask_t task_buffer;
+    xTaskCreateStatic(rs485_task, "RS485", sizeof(stack_buffer), NULL, 5, stack_buffer, &task_buffer);
+}
+
+
+int rs485_read_frame(rs485_frame_t *frame, unsigned long timeout_ms) {
+    if (xQueueReceive(frame_queue, frame, pdMS_TO_TICKS(timeout_ms)) == pdTRUE) {
+        return frame->len;
+    } else {
+        return 0;
+    }
 }
 
 
-int rs485_read(uint8_t *buffer, size_t len) {
-    return uart_read_bytes(MB_PORTNUM, buffer, len, pdMS_TO_TICKS(MODBUS_TIMEOUT));
+/*
+ * Sets a task to be notified (with `xTaskNotify`, setting `bits`) whenever a new frame is available
+ */
+void rs485_set_notification(TaskHandle_t task, uint32_t bits) {
+    notify_bits = bits;
+    __atomic_store_n(&notify_task, task, __ATOMIC_RELEASE);
 }
 
 
@@ -44,4 +97,173 @@ int rs485_write(uint8_t *buffer, size_t len) {
 
 void rs485_flush(void) {
     uart_flush_input(MB_PORTNUM);
-}
\ No newline at end of file
+}
+
+
+uint8_t rs485_is_valid_serial(uint32_t baudrate, rs485_parity_t parity) {
+    if (parity > RS485_PARITY_ODD) {
+        return 0;
+    }
+
+    switch (baudrate) {
+        case 9600:
+        case 19200:
+        case 38400:
+        case 57600:
+        case 115200:
+        case 230400:
+        case 460800:
+        case 921600:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+
+/*
+ * Changes baud rate and parity, waiting for any pending transmission (e.g. the response to the request that
+ * asked for the change) to complete first.
+ */
+int rs485_set_serial(uint32_t baudrate, rs485_parity_t parity) {
+    const uart_parity_t parities[] = {
+        [RS485_PARITY_NONE] = UART_PARITY_DISABLE,
+        [RS485_PARITY_EVEN] = UART_PARITY_EVEN,
+        [RS485_PARITY_ODD]  = UART_PARITY_ODD,
+    };
+
+    if (!rs485_is_valid_serial(baudrate, parity)) {
+        return -1;
+    }
+
+    uart_wait_tx_done(MB_PORTNUM, pdMS_TO_TICKS(TX_DONE_TIMEOUT_MS));
+    ESP_ERROR_CHECK(uart_set_baudrate(MB_PORTNUM, baudrate));
+    ESP_ERROR_CHECK(uart_set_parity(MB_PORTNUM, parities[parity]));
+    ESP_ERROR_CHECK(uart_set_rx_timeout(MB_PORTNUM, rx_timeout_symbols(baudrate, parity)));
+
+    ESP_LOGI(TAG, "Serial set to %lu baud, parity %i", (unsigned long)baudrate, parity);
+    return 0;
+}
+
+
+void rs485_get_statistics(rs485_statistics_t *statistics) {
+    statistics->recovered_frames = framer.recovered;
+    statistics->overruns         = overruns;
+}
+
+
+void rs485_clear_overruns(void) {
+    overruns = 0;
+}
+
+
+void rs485_clear_statistics(void) {
+    framer.recovered = 0;
+    overruns         = 0;
+}
+
+
+/*
+ * Feeds the received bytes to the RTU framer. A frame is handed over through `frame_queue` as soon as the framer
+ * recognizes its end, or when the UART reports an RX timeout (no activity for the Modbus RTU frame gap).
+ */
+static void rs485_task(void *args) {
+    (void)args;
+    uint8_t chunk[64];
+
+    for (;;) {
+        uart_event_t event = {0};
+        if (xQueueReceive(uart_queue, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        switch (event.type) {
+            case UART_DATA: {
+                size_t remaining = event.size;
+                while (remaining > 0) {
+                    int read =
+                        uart_read_bytes(MB_PORTNUM, chunk, remaining < sizeof(chunk) ? remaining : sizeof(chunk), 0);
+                    if (read <= 0) {
+                        break;
+                    }
+                    remaining -= read;
+
+                    for (int i = 0; i < read; i++) {
+                        if (rtu_framer_push(&framer, chunk[i])) {
+                            send_frame(&framer);
+                        }
+                    }
+                }
+
+                if (event.timeout_flag) {
+                    if (framer.overflow) {
+                        overruns++;
+                    }
+
+                    if (rtu_framer_gap(&framer)) {
+                        send_frame(&framer);
+                    } else {
+                        rtu_framer_reset(&framer);
+                    }
+                }
+                break;
+            }
+
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                ESP_LOGW(TAG, "RX overflow (%i)", event.type);
+                overruns++;
+                uart_flush_input(MB_PORTNUM);
+                xQueueReset(uart_queue);
+                // Whatever was received so far is lost anyway
+                rtu_framer_gap(&framer);
+                rtu_framer_reset(&framer);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+
+static void send_frame(rtu_framer_t *framer) {
+    static rs485_frame_t frame = {0};
+
+    memcpy(frame.data, framer->buffer, framer->len);
+    frame.len       = framer->len;
+    frame.crc_ok    = rtu_framer_crc_ok(framer);
+    frame.timestamp = esp_timer_get_time();
+    rtu_framer_reset(framer);
+
+    if (xQueueSend(frame_queue, &frame, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Frame queue full, dropping %i bytes", frame.len);
+    }
+
+    TaskHandle_t task = __atomic_load_n(&notify_task, __ATOMIC_ACQUIRE);
+    if (task != NULL) {
+        xTaskNotify(task, notify_bits, eSetBits);
+    }
+}
+
+
+/*
+ * RX timeout in character times covering the Modbus RTU frame gap: 3.5 characters up to 19200 baud, 1.75 ms above
+ */
+static uint8_t rx_timeout_symbols(uint32_t baudrate, rs485_parity_t parity) {
+    uint64_t bits_per_symbol = parity == RS485_PARITY_NONE ? 10 : 11;
+    uint64_t symbol_ns       = (bits_per_symbol * 1000000000ULL) / baudrate;
+    uint64_t gap_ns          = baudrate > FRAME_GAP_FIXED_BAUDRATE ? FRAME_GAP_FIXED_NS
+                                                                   : (symbol_ns * FRAME_GAP_HALF_CHARACTERS + 1) / 2;
+    uint64_t symbols         = (gap_ns + symbol_ns - 1) / symbol_ns;
+
+    if (symbols < 1) {
+        return 1;
+    } else if (symbols > MAX_RX_TOUT) {
+        return MAX_RX_TOUT;
+    } else {
+        return (uint8_t)symbols;
+    }
+}
@@ -4,12 +4,46 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "rtu_framer.h"
 
 
-void rs485_init(void);
-int  rs485_read(uint8_t *buffer, size_t len);
-int  rs485_write(uint8_t *buffer, size_t len);
-void rs485_flush(void);
+#define RS485_MAX_FRAME_SIZE RTU_FRAMER_MAX_FRAME_SIZE
 
+#define RS485_DEFAULT_BAUDRATE 115200
 
-#endif
\ No newline at end of file
+
+typedef enum {
+    RS485_PARITY_NONE = 0,
+    RS485_PARITY_EVEN,
+    RS485_PARITY_ODD,
+} rs485_parity_t;
+
+
+typedef struct {
+    uint8_t  data[RS485_MAX_FRAME_SIZE];
+    uint16_t len;
+    uint8_t  crc_ok;
+    int64_t  timestamp;     // Time of reception (esp_timer, us)
+} rs485_frame_t;
+
+typedef struct {
+    uint32_t recovered_frames;
+    uint32_t overruns;
+} rs485_statistics_t;
+
+
+void     rs485_init(void);
+int      rs485_read_frame(rs485_frame_t *frame, unsigned long timeout_ms);
+int      rs485_write(uint8_t *buffer, size_t len);
+void     rs485_flush(void);
+void     rs485_set_notification(TaskHandle_t task, uint32_t bits);
+int      rs485_set_serial(uint32_t baudrate, rs485_parity_t parity);
+uint8_t  rs485_is_valid_serial(uint32_t baudrate, rs485_parity_t parity);
+void     rs485_get_statistics(rs485_statistics_t *statistics);
+void     rs485_clear_overruns(void);
+void     rs485_clear_statistics(void);
+
+
+#endif
@@ -0,0 +1,115 @@
+#include <string.h>
+#include <assert.h>
+#include "rtu_framer.h"
+
+
+#define CRC_INIT       0xFFFF
+#define CRC_POLYNOMIAL 0xA001
+
+
+static uint16_t crc_update(uint16_t crc, uint8_t byte);
+static uint8_t  is_frame_length(const uint8_t *buffer, uint16_t len);
+
+
+void rtu_framer_init(rtu_framer_t *framer) {
+    assert(framer != NULL);
+    memset(framer, 0, sizeof(*framer));
+    rtu_framer_reset(framer);
+}
+
+
+/*
+ * Discards the current frame; the statistics are kept
+ */
+void rtu_framer_reset(rtu_framer_t *framer) {
+    framer->len      = 0;
+    framer->crc      = CRC_INIT;
+    framer->overflow = 0;
+}
+
+
+/*
+ * Adds a received byte to the current frame. Returns 1 if the byte completes a request that can be recognized
+ * before the inter-frame gap (valid CRC at a length allowed by the function code); the frame is then in
+ * `buffer` and the caller should reset the framer after consuming it.
+ */
+int rtu_framer_push(rtu_framer_t *framer, uint8_t byte) {
+    if (framer->split) {
+        // Bytes following a frame without any silence in between: the frame would have been merged with this one
+        framer->recovered++;
+        framer->split = 0;
+    }
+
+    if (framer->len >= sizeof(framer->buffer)) {
+        framer->overflow = 1;
+        return 0;
+    }
+
+    framer->buffer[framer->len++] = byte;
+    framer->crc                   = crc_update(framer->crc, byte);
+
+    if (framer->len >= RTU_FRAMER_MIN_FRAME_SIZE && framer->crc == 0 && is_frame_length(framer->buffer, framer->len)) {
+        framer->split = 1;
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+
+/*
+ * Signals an inter-frame gap (3.5 characters of silence). Returns 1 if the bytes received so far should be
+ * handed over as a frame, regardless of their CRC.
+ */
+int rtu_framer_gap(rtu_framer_t *framer) {
+    framer->split = 0;
+    return framer->len > 0 && !framer->overflow;
+}
+
+
+int rtu_framer_crc_ok(rtu_framer_t *framer) {
+    return framer->len >= RTU_FRAMER_MIN_FRAME_SIZE && framer->crc == 0;
+}
+
+
+static uint16_t crc_update(uint16_t crc, uint8_t byte) {
+    crc ^= byte;
+    for (int i = 0; i < 8; i++) {
+        if (crc & 0x0001) {
+            crc = (crc >> 1) ^ CRC_POLYNOMIAL;
+        } else {
+            crc >>= 1;
+        }
+    }
+    return crc;
+}
+
+
+/*
+ * Whether `len` is a valid length for a request with the function code found in the frame. Only requests are
+ * recognized: responses can be shorter than the request with the same function code (an FC03 response with
+ * a single register is 7 bytes, a request 8), so matching them would split requests early. Responses from the
+ * other devices on the bus, like function codes without a fixed length, are delimited by the inter-frame gap.
+ */
+static uint8_t is_frame_length(const uint8_t *buffer, uint16_t len) {
+    switch (buffer[1]) {
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+        case 6:
+        case 8:
+            return len == 8;
+
+        case 15:
+        case 16:
+            return len > 6 && len == 9 + buffer[6];
+
+        case 22:
+            return len == 10;
+
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef RTU_FRAMER_H_INCLUDED
+#define RTU_FRAMER_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+#define RTU_FRAMER_MAX_FRAME_SIZE 256
+#define RTU_FRAMER_MIN_FRAME_SIZE 4
+
+
+typedef struct {
+    uint8_t  buffer[RTU_FRAMER_MAX_FRAME_SIZE];
+    uint16_t len;
+    uint16_t crc;          // Running CRC of `buffer`; 0 once a complete frame (CRC included) has been received
+    uint8_t  overflow;     // Too many bytes before the gap, the frame is discarded
+    uint8_t  split;        // The last frame was closed without a gap
+
+    uint32_t recovered;     // Frames told apart without an inter-frame gap
+} rtu_framer_t;
+
+
+void rtu_framer_init(rtu_framer_t *framer);
+void rtu_framer_reset(rtu_framer_t *framer);
+int  rtu_framer_push(rtu_framer_t *framer, uint8_t byte);
+int  rtu_framer_gap(rtu_framer_t *framer);
+int  rtu_framer_crc_ok(rtu_framer_t *framer);
+
+
+#endif
@@ -2,18 +2,57 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "storage.h"
 
 #define COMPATIBILITY_KEY     "COMPATIBILITY"
 #define COMPATIBILITY_VERSION 1
 
+#define NAMESPACE "storage"
+
+#define STORAGE_DEFINE(name, type, nvs)                                                                                \
+    int storage_load_##name(type *value, char *key) {                                                                  \
+        assert(strlen(key) <= 15);                                                                                     \
+        xSemaphoreTakeRecursive(sem, portMAX_DELAY);                                                                   \
+        esp_err_t err = nvs_get_##nvs(handle, key, value);                                                             \
+        xSemaphoreGiveRecursive(sem);                                                                                  \
+        return check_load(err, key);                                                                                   \
+    }                                                                                                                  \
+                                                                                                                       \
+    int storage_save_##name(type *value, char *key) {                                                                  \
+        assert(strlen(key) <= 15);                                                                                     \
+        storage_begin();                                                                                               \
+        check_save(nvs_set_##nvs(handle, key, *value), key);                                                           \
+        return storage_commit();                                                                                       \
+    }
+
+
+static int  check_load(esp_err_t err, const char *key);
+static void check_save(esp_err_t err, const char *key);
+
 
 static const char *TAG = "Storage";
 
+/*
+ *  The handle stays open for the whole lifetime of the firmware. A session (storage_begin/storage_commit, which
+ *  may nest) holds the lock across several operations and issues a single nvs_commit call when the outermost one
+ *  ends; a save outside of any session is a session of its own. NVS writes reach the flash in nvs_set_* already,
+ *  so a session neither saves flash writes nor makes several keys change atomically.
+ */
+static SemaphoreHandle_t sem;
+static nvs_handle_t      handle;
+static unsigned int      depth  = 0;
+static uint8_t           dirty  = 0;
+static uint8_t           failed = 0;
+
 
 void storage_init(void) {
+    static StaticSemaphore_t semaphore_buffer;
+    sem = xSemaphoreCreateRecursiveMutexStatic(&semaphore_buffer);
+
     // Initialize NVS
     esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -25,8 +64,7 @@ void storage_init(void) {
         ESP_ERROR_CHECK(err);
     }
 
-    nvs_handle_t handle;
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &handle));
+    ESP_ERROR_CHECK(nvs_open(NAMESPACE, NVS_READWRITE, &handle));
     uint8_t buf;
     err = nvs_get_u8(handle, COMPATIBILITY_KEY, &buf);
 
@@ -34,7 +72,6 @@ void storage_init(void) {
         if (buf != COMPATIBILITY_VERSION) {
             ESP_LOGI(TAG,
                      "The previously saved configuration is not compatibile with the new firmware version; erasing...");
-            nvs_close(handle);
             ESP_ERROR_CHECK(nvs_erase_all(handle));
             ESP_ERROR_CHECK(nvs_set_u8(handle, COMPATIBILITY_KEY, COMPATIBILITY_VERSION));
             ESP_ERROR_CHECK(nvs_commit(handle));
@@ -44,171 +81,70 @@ void storage_init(void) {
         ESP_ERROR_CHECK(nvs_commit(handle));
     }
 
-    nvs_close(handle);
     ESP_LOGI(TAG, "Storage initialized!");
 }
 
 
-int storage_load_uint8(uint8_t *value, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
-    assert(strlen(key) <= 15);
-
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_u8(handle, key, value);
-    nvs_close(handle);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
-        return -1;
-    }
-
-    return 0;
-}
-
-
-void storage_save_uint8(uint8_t *value, char *key) {
-    nvs_handle_t handle;
-    assert(strlen(key) <= 15);
-
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
-
-    err = nvs_set_u8(handle, key, *value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
-    } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
-    }
-}
-
-
-int storage_load_uint16(uint16_t *value, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
-    assert(strlen(key) <= 15);
-
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_u16(handle, key, value);
-    nvs_close(handle);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
-        return -1;
-    }
-
-    return 0;
-}
-
-
-void storage_save_uint16(uint16_t *value, char *key) {
-    nvs_handle_t handle;
-    ESP_LOGI(TAG, "Trying to save key %s", key);
-    assert(strlen(key) <= 15);
-
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
-
-    err = nvs_set_u16(handle, key, *value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
-    } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
-    }
+void storage_begin(void) {
+    xSemaphoreTakeRecursive(sem, portMAX_DELAY);
+    depth++;
 }
 
 
-int storage_load_uint32(uint32_t *value, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
-    assert(strlen(key) <= 15);
+/*
+ * Ends a session; the outermost one calls nvs_commit. Returns -1 if any write of the session or the commit itself
+ * failed.
+ */
+int storage_commit(void) {
+    int res = 0;
+
+    assert(depth > 0);
+    if (--depth == 0) {
+        if (dirty) {
+            esp_err_t err = nvs_commit(handle);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "NVS error (%s) while committing", esp_err_to_name(err));
+                failed = 1;
+            }
+        }
 
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_u32(handle, key, value);
-    nvs_close(handle);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
-        return -1;
+        res    = failed ? -1 : 0;
+        dirty  = 0;
+        failed = 0;
     }
 
-    return 0;
+    xSemaphoreGiveRecursive(sem);
+    return res;
 }
 
 
-void storage_save_uint32(uint32_t *value, char *key) {
-    nvs_handle_t handle;
-    ESP_LOGI(TAG, "Trying to save key %s", key);
-    assert(strlen(key) <= 15);
-
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
-
-    err = nvs_set_u32(handle, key, *value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
-    } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
-    }
-}
+STORAGE_TYPES(STORAGE_DEFINE)
 
 
-int storage_load_uint64(uint64_t *value, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
+int storage_load_blob(void *value, size_t len, char *key) {
     assert(strlen(key) <= 15);
 
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_u64(handle, key, value);
-    nvs_close(handle);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
-        return -1;
-    }
+    xSemaphoreTakeRecursive(sem, portMAX_DELAY);
+    esp_err_t err = nvs_get_blob(handle, key, value, &len);
+    xSemaphoreGiveRecursive(sem);
 
-    return 0;
+    return check_load(err, key);
 }
 
 
-void storage_save_uint64(uint64_t *value, char *key) {
-    nvs_handle_t handle;
-    ESP_LOGI(TAG, "Trying to save key %s", key);
+int storage_save_blob(void *value, size_t len, char *key) {
     assert(strlen(key) <= 15);
 
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
-
-    err = nvs_set_u64(handle, key, *value);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
-    } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
-    }
+    storage_begin();
+    check_save(nvs_set_blob(handle, key, value, len), key);
+    return storage_commit();
 }
 
 
-int storage_load_blob(void *value, size_t len, char *key) {
-    nvs_handle_t handle;
-    esp_err_t    err;
-    assert(strlen(key) <= 15);
-
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READONLY, &handle));
-    err = nvs_get_blob(handle, key, value, &len);
-    nvs_close(handle);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+static int check_load(esp_err_t err, const char *key) {
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return 1;
+    } else if (err != ESP_OK) {
         ESP_LOGE(TAG, "NVS error (%s) while reading %s", esp_err_to_name(err), key);
         return -1;
     }
@@ -217,22 +153,12 @@ int storage_load_blob(void *value, size_t len, char *key) {
 }
 
 
-void storage_save_blob(void *value, size_t len, char *key) {
-    nvs_handle_t handle;
-    ESP_LOGI(TAG, "Trying to save key %s", key);
-    assert(strlen(key) <= 15);
-
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
+static void check_save(esp_err_t err, const char *key) {
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%i) opening NVS handle!\n", err);
-        return;
-    }
-
-    err = nvs_set_blob(handle, key, value, len);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "NVS error (%i) while writing %s", err, key);
+        ESP_LOGE(TAG, "NVS error (%s) while writing %s", esp_err_to_name(err), key);
+        failed = 1;
     } else {
-        ESP_ERROR_CHECK(nvs_commit(handle));
-        nvs_close(handle);
+        ESP_LOGD(TAG, "Written key %s", key);
+        dirty = 1;
     }
 }
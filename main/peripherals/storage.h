@@ -4,17 +4,26 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+
+// Scalar types with typed load/save helpers: name, C type and NVS accessor suffix
+#define STORAGE_TYPES(X)                                                                                               \
+    X(uint8, uint8_t, u8)                                                                                              \
+    X(uint16, uint16_t, u16)                                                                                           \
+    X(uint32, uint32_t, u32)                                                                                           \
+    X(uint64, uint64_t, u64)
+
+#define STORAGE_DECLARE(name, type, nvs)                                                                               \
+    int storage_load_##name(type *value, char *key);                                                                   \
+    int storage_save_##name(type *value, char *key);
+
+
 void storage_init(void);
+void storage_begin(void);
+int  storage_commit(void);
+
+// Loads return 0 on success, 1 if the key is not there (the value is left untouched) and -1 on errors
+STORAGE_TYPES(STORAGE_DECLARE)
+int storage_load_blob(void *value, size_t len, char *key);
+int storage_save_blob(void *value, size_t len, char *key);
 
-int  storage_load_uint8(uint8_t *value, char *key);
-void storage_save_uint8(uint8_t *value, char *key);
-int  storage_load_uint16(uint16_t *value, char *key);
-void storage_save_uint16(uint16_t *value, char *key);
-int  storage_load_uint32(uint32_t *value, char *key);
-void storage_save_uint32(uint32_t *value, char *key);
-int  storage_load_uint64(uint64_t *value, char *key);
-void storage_save_uint64(uint64_t *value, char *key);
-int  storage_load_blob(void *value, size_t len, char *key);
-void storage_save_blob(void *value, size_t len, char *key);
-
-#endif
\ No newline at end of file
+#endif
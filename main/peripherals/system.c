@@ -1,6 +1,26 @@
 #include <esp_random.h>
 #include <bootloader_random.h>
 #include <esp_system.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "system.h"
+
+
+static const char *TAG = "System";
+
+/*
+ *  Every allocation goes through the heap hook; once the watch has started the ones made by tasks that are not
+ *  expected to allocate are counted. A low watermark would miss allocations reusing freed memory.
+ */
+static volatile uint8_t  heap_watching        = 0;
+static TaskHandle_t      heap_excluded_task   = NULL;
+static volatile uint32_t heap_allocations     = 0;
+static volatile uint32_t heap_allocated_bytes = 0;
+static uint32_t          heap_checked         = 0;
+static uint32_t          heap_checked_bytes   = 0;
 
 
 void system_random_init(void) {
@@ -8,4 +28,63 @@ void system_random_init(void) {
     bootloader_random_enable();
     srand(esp_random());
     bootloader_random_disable();
-}
\ No newline at end of file
+}
+
+
+/*
+ * The console task allocates for argument parsing and line editing, which is expected: it can be left out of the
+ * watch.
+ */
+void system_heap_watch_exclude_task(TaskHandle_t task) {
+    heap_excluded_task = task;
+}
+
+
+void system_heap_watch_start(void) {
+#if CONFIG_HEAP_USE_HOOKS
+    heap_checked       = __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED);
+    heap_checked_bytes = __atomic_load_n(&heap_allocated_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&heap_watching, 1, __ATOMIC_RELEASE);
+#else
+    ESP_LOGW(TAG, "CONFIG_HEAP_USE_HOOKS is disabled, heap allocations are not watched");
+#endif
+}
+
+
+/*
+ * Returns how many allocations were made since the last call (or since `system_heap_watch_start`) and stores
+ * their total size in `bytes`.
+ */
+size_t system_heap_watch_check(size_t *bytes) {
+    uint32_t allocations = __atomic_load_n(&heap_allocations, __ATOMIC_RELAXED);
+    uint32_t allocated   = __atomic_load_n(&heap_allocated_bytes, __ATOMIC_RELAXED);
+
+    size_t count       = allocations - heap_checked;
+    *bytes             = allocated - heap_checked_bytes;
+    heap_checked       = allocations;
+    heap_checked_bytes = allocated;
+    return count;
+}
+
+
+#if CONFIG_HEAP_USE_HOOKS
+// Called by the heap component after every successful allocation
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) {
+    (void)caps;
+
+    if (ptr == NULL || !__atomic_load_n(&heap_watching, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (heap_excluded_task != NULL && xTaskGetCurrentTaskHandle() == heap_excluded_task) {
+        return;
+    }
+
+    __atomic_fetch_add(&heap_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&heap_allocated_bytes, (uint32_t)size, __ATOMIC_RELAXED);
+}
+
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr) {
+    (void)ptr;
+}
+#endif
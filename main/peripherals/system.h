@@ -2,7 +2,15 @@
 #define SYSTEM_H_INCLUDED
 
 
-void system_random_init(void);
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 
-#endif
\ No newline at end of file
+void   system_random_init(void);
+void   system_heap_watch_exclude_task(TaskHandle_t task);
+void   system_heap_watch_start(void);
+size_t system_heap_watch_check(size_t *bytes);
+
+
+#endif
@@ -0,0 +1,64 @@
+#include <driver/gpio.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "hardwareprofile.h"
+#include "tach.h"
+
+
+// Edges closer than this are ringing on the open collector line, not pulses (that would be 150000 rpm)
+#define MIN_PULSE_US 200
+
+
+static void IRAM_ATTR tach_isr(void *args);
+
+
+static const char *TAG = "Tach";
+
+/*
+ *  The C3 has no pulse counter, so pulses are counted by the GPIO interrupt along with the time of the last
+ *  one: speed is computed from the time between edges rather than from a count over a fixed window.
+ */
+static portMUX_TYPE   lock    = portMUX_INITIALIZER_UNLOCKED;
+static tach_reading_t reading = {0};
+
+
+void tach_init(void) {
+    gpio_config_t config = {
+        .intr_type    = GPIO_INTR_NEGEDGE,
+        .mode         = GPIO_MODE_INPUT,
+        .pin_bit_mask = BIT64(HAP_TACH),
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .pull_up_en   = GPIO_PULLUP_ENABLE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&config));
+
+    // Other inputs may have installed the service already
+    esp_err_t err = gpio_install_isr_service(HAP_GPIO_INTR_FLAGS);
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(HAP_TACH, tach_isr, NULL));
+
+    ESP_LOGI(TAG, "Initialized");
+}
+
+
+void tach_read(tach_reading_t *result) {
+    portENTER_CRITICAL(&lock);
+    *result = reading;
+    portEXIT_CRITICAL(&lock);
+}
+
+
+static void IRAM_ATTR tach_isr(void *args) {
+    (void)args;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL_ISR(&lock);
+    if (now - reading.last_edge_us >= MIN_PULSE_US) {
+        reading.pulses++;
+        reading.last_edge_us = now;
+    }
+    portEXIT_CRITICAL_ISR(&lock);
+}
@@ -0,0 +1,18 @@
+#ifndef TACH_H_INCLUDED
+#define TACH_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+typedef struct {
+    uint32_t pulses;          // Free running
+    int64_t  last_edge_us;    // esp_timer time of the last counted pulse
+} tach_reading_t;
+
+
+void tach_init(void);
+void tach_read(tach_reading_t *reading);
+
+
+#endif
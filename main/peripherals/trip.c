@@ -0,0 +1,246 @@
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
+#include <soc/gpio_sig_map.h>
+#include <esp_rom_gpio.h>
+#include <esp_rom_sys.h>
+#include <esp_intr_alloc.h>
+#include <soc/gpio_reg.h>
+#include <soc/interrupts.h>
+#include <soc/soc.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "hardwareprofile.h"
+#include "trip.h"
+#include "outputs.h"
+
+
+// The debounced input needs 5 samples, 10 ms apart, to follow a change
+#define REARM_DELAY_US 100000LL
+
+
+static void IRAM_ATTR trip_isr(void *args);
+static void IRAM_ATTR apply_output(uint8_t level);
+
+
+static const char *TAG = "Trip";
+
+/*
+ *  The safety input opening edge cuts HAP_OUTPUT and detaches the PWM signal from its pin straight from the
+ *  interrupt, without waiting for the debounce filter and the controller. Outputs stay off until the controller
+ *  rearms the trip after the debounced input reports a safe state again.
+ */
+static portMUX_TYPE      lock        = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t          pwm_signal  = 0;
+static uint8_t           armed       = 1;
+static uint8_t           latched     = 0;
+static uint8_t           confirmed   = 0;
+static int64_t           trip_time   = 0;
+static TaskHandle_t      notify_task = NULL;
+static uint32_t          notify_bits = 0;
+static trip_statistics_t statistics  = {0};
+static uint32_t          last_cycles = 0;
+static uint32_t          max_cycles  = 0;
+// Level requested for the next zero crossing, -1 if none
+static int8_t  pending_level = -1;
+static int64_t pending_since = 0;
+static uint8_t output_level  = 0;
+
+
+void trip_init(uint32_t signal) {
+    pwm_signal = signal;
+
+    // Other inputs may have installed the service already
+    esp_err_t err = gpio_install_isr_service(HAP_GPIO_INTR_FLAGS);
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+
+    /*
+     *  The trip handler sits directly on the GPIO interrupt instead of going through the ISR service dispatch.
+     *  Shared handlers run latest first, so allocating it after the service makes it see (and clear) its status bit
+     *  before the service loop does; the status mask keeps it from running for the other inputs.
+     */
+    static intr_handle_t handle;
+    ESP_ERROR_CHECK(esp_intr_alloc_intrstatus(ETS_GPIO_INTR_SOURCE, HAP_GPIO_INTR_FLAGS, GPIO_STATUS_REG,
+                                              BIT(HAP_INPUT), trip_isr, NULL, &handle));
+    // The input is active low: the safety contact opening is a rising edge
+    ESP_ERROR_CHECK(gpio_set_intr_type(HAP_INPUT, GPIO_INTR_POSEDGE));
+    ESP_ERROR_CHECK(gpio_intr_enable(HAP_INPUT));
+
+    ESP_LOGI(TAG, "Initialized");
+}
+
+
+/*
+ * Sets a task to be notified (with `xTaskNotify`, setting `bits`) whenever the trip fires
+ */
+void trip_set_notification(TaskHandle_t task, uint32_t bits) {
+    notify_bits = bits;
+    __atomic_store_n(&notify_task, task, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Disarming (safety bypass) also releases a latched trip
+ */
+void trip_set_armed(uint8_t value) {
+    portENTER_CRITICAL(&lock);
+    armed = value;
+    if (!armed && latched) {
+        latched = 0;
+        esp_rom_gpio_connect_out_signal(HAP_PWM, pwm_signal, false, false);
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+
+/*
+ * To be called when the debounced input reports the safety contact open; records how long the filter took
+ */
+void trip_confirm(void) {
+    portENTER_CRITICAL(&lock);
+    if (latched && !confirmed) {
+        confirmed                  = 1;
+        statistics.last_confirm_ms = (uint32_t)((esp_timer_get_time() - trip_time) / 1000);
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+
+/*
+ * To be called while the debounced input reports a safe state. The trip is released only once the filter has
+ * had time to see the opening, so that a short glitch cannot rearm it.
+ */
+void trip_rearm(void) {
+    portENTER_CRITICAL(&lock);
+    if (latched && esp_timer_get_time() - trip_time >= REARM_DELAY_US) {
+        latched = 0;
+        esp_rom_gpio_connect_out_signal(HAP_PWM, pwm_signal, false, false);
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+
+uint8_t trip_is_latched(void) {
+    return __atomic_load_n(&latched, __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * Drives HAP_OUTPUT right away, dropping any synchronized request; the output cannot be turned on while the trip
+ * is latched
+ */
+void trip_set_output(uint8_t level) {
+    portENTER_CRITICAL(&lock);
+    pending_level = -1;
+    if (!level || !latched) {
+        outputs_set(OUTPUT_HAP, level);
+        output_level = level;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+
+/*
+ * Drives HAP_OUTPUT at the next zero crossing, when the load current is lowest. Requests that would not change
+ * the output are dropped.
+ */
+void trip_set_output_synchronized(uint8_t level) {
+    portENTER_CRITICAL(&lock);
+    if (level == output_level || (level && latched)) {
+        pending_level = -1;
+    } else if (pending_level != level) {
+        pending_level = level;
+        pending_since = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+
+/*
+ * Applies a synchronized request that is still waiting after `timeout_us`, in case the crossings stopped
+ */
+void trip_flush_output(int64_t timeout_us) {
+    portENTER_CRITICAL(&lock);
+    if (pending_level >= 0 && esp_timer_get_time() - pending_since >= timeout_us) {
+        apply_output(pending_level);
+        pending_level = -1;
+    }
+    portEXIT_CRITICAL(&lock);
+}
+
+
+/*
+ * To be hooked to the zero-cross interrupt
+ */
+void IRAM_ATTR trip_zero_cross(void) {
+    portENTER_CRITICAL_ISR(&lock);
+    if (pending_level >= 0) {
+        apply_output(pending_level);
+        pending_level = -1;
+    }
+    portEXIT_CRITICAL_ISR(&lock);
+}
+
+
+void trip_get_statistics(trip_statistics_t *result) {
+    uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+
+    portENTER_CRITICAL(&lock);
+    *result                 = statistics;
+    result->last_handler_ns = (uint32_t)(((uint64_t)last_cycles * 1000) / ticks_per_us);
+    result->max_handler_ns  = (uint32_t)(((uint64_t)max_cycles * 1000) / ticks_per_us);
+    portEXIT_CRITICAL(&lock);
+}
+
+
+static void IRAM_ATTR trip_isr(void *args) {
+    (void)args;
+    uint32_t   start = esp_cpu_get_cycle_count();
+    BaseType_t woken = pdFALSE;
+
+    gpio_ll_clear_intr_status_bit(&GPIO, HAP_INPUT);
+
+    portENTER_CRITICAL_ISR(&lock);
+    if (armed && !latched) {
+        gpio_ll_set_level(&GPIO, HAP_OUTPUT, 0);
+        outputs_invalidate(OUTPUT_HAP);
+        output_level  = 0;
+        pending_level = -1;
+        // Turn the PWM pin into a plain GPIO driven low
+        gpio_ll_set_level(&GPIO, HAP_PWM, 0);
+        esp_rom_gpio_connect_out_signal(HAP_PWM, SIG_GPIO_OUT_IDX, false, false);
+
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+        latched         = 1;
+        confirmed       = 0;
+        trip_time       = esp_timer_get_time();
+        last_cycles     = cycles;
+        if (cycles > max_cycles) {
+            max_cycles = cycles;
+        }
+        statistics.count++;
+
+        if (notify_task != NULL) {
+            xTaskNotifyFromISR(notify_task, notify_bits, eSetBits, &woken);
+        }
+    }
+    portEXIT_CRITICAL_ISR(&lock);
+
+    portYIELD_FROM_ISR(woken);
+}
+
+
+/*
+ * Called with the lock held, possibly from an interrupt: bypasses the output driver, which is told to forget it
+ */
+static void IRAM_ATTR apply_output(uint8_t level) {
+    if (!level || !latched) {
+        gpio_ll_set_level(&GPIO, HAP_OUTPUT, level);
+        outputs_invalidate(OUTPUT_HAP);
+        output_level = level;
+    }
+}
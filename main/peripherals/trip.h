@@ -0,0 +1,32 @@
+#ifndef TRIP_H_INCLUDED
+#define TRIP_H_INCLUDED
+
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+
+typedef struct {
+    uint32_t count;
+    // From the start of the trip handler to the output cut; interrupt entry and dispatch are not included
+    uint32_t last_handler_ns;
+    uint32_t max_handler_ns;
+    uint32_t last_confirm_ms;     // From the trip to the debounced input reporting it
+} trip_statistics_t;
+
+
+void    trip_init(uint32_t pwm_signal);
+void    trip_set_notification(TaskHandle_t task, uint32_t bits);
+void    trip_set_armed(uint8_t armed);
+void    trip_confirm(void);
+void    trip_rearm(void);
+uint8_t trip_is_latched(void);
+void    trip_set_output(uint8_t level);
+void    trip_set_output_synchronized(uint8_t level);
+void    trip_flush_output(int64_t timeout_us);
+void    trip_zero_cross(void);
+void    trip_get_statistics(trip_statistics_t *statistics);
+
+
+#endif
@@ -0,0 +1,92 @@
+#include <driver/gpio.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "hardwareprofile.h"
+#include "zero_cross.h"
+
+
+// A power of two; the reader drains it every 50 ms, that is 6 crossings at 60 Hz
+#define MAX_TIMESTAMPS 32
+
+
+static void IRAM_ATTR zero_cross_isr(void *args);
+
+
+static const char *TAG = "ZeroCross";
+
+/*
+ *  Single producer (the interrupt), single consumer ring of crossing timestamps. Edges arriving while the ring is
+ *  full are dropped and counted.
+ */
+static int64_t           timestamps[MAX_TIMESTAMPS] = {0};
+static uint32_t          head                       = 0;
+static uint32_t          tail                       = 0;
+static uint32_t          overruns                   = 0;
+static zero_cross_hook_t hook                       = NULL;
+
+
+void zero_cross_init(void) {
+    gpio_config_t config = {
+        .intr_type    = GPIO_INTR_POSEDGE,
+        .mode         = GPIO_MODE_INPUT,
+        .pin_bit_mask = BIT64(HAP_ZERO_CROSS),
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .pull_up_en   = GPIO_PULLUP_DISABLE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&config));
+
+    // Other inputs may have installed the service already
+    esp_err_t err = gpio_install_isr_service(HAP_GPIO_INTR_FLAGS);
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(HAP_ZERO_CROSS, zero_cross_isr, NULL));
+
+    ESP_LOGI(TAG, "Initialized");
+}
+
+
+void zero_cross_set_hook(zero_cross_hook_t function) {
+    __atomic_store_n(&hook, function, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Moves up to `max` crossing timestamps (esp_timer microseconds, oldest first) recorded since the last call
+ */
+size_t zero_cross_read(int64_t *result, size_t max) {
+    uint32_t end   = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    size_t   count = 0;
+
+    while (tail != end && count < max) {
+        result[count++] = timestamps[tail % MAX_TIMESTAMPS];
+        tail++;
+    }
+    __atomic_store_n(&tail, tail, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+
+uint32_t zero_cross_get_overruns(void) {
+    return __atomic_load_n(&overruns, __ATOMIC_RELAXED);
+}
+
+
+static void IRAM_ATTR zero_cross_isr(void *args) {
+    (void)args;
+    int64_t now = esp_timer_get_time();
+
+    zero_cross_hook_t function = __atomic_load_n(&hook, __ATOMIC_ACQUIRE);
+    if (function != NULL) {
+        function();
+    }
+
+    if (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) < MAX_TIMESTAMPS) {
+        timestamps[head % MAX_TIMESTAMPS] = now;
+        __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+    } else {
+        overruns++;
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef ZERO_CROSS_H_INCLUDED
+#define ZERO_CROSS_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+// Called from the interrupt on every crossing, must be in IRAM
+typedef void (*zero_cross_hook_t)(void);
+
+
+void     zero_cross_init(void);
+void     zero_cross_set_hook(zero_cross_hook_t hook);
+size_t   zero_cross_read(int64_t *timestamps, size_t max);
+uint32_t zero_cross_get_overruns(void);
+
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef FAN_PLANT_H_INCLUDED
+#define FAN_PLANT_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+void fan_plant_set_duty(uint32_t duty);
+void fan_plant_set_enabled(uint8_t enabled);
+void fan_plant_set_load(uint16_t permille);
+void fan_plant_set_parameters(uint16_t max_rpm, uint32_t time_constant_ms);
+
+
+#endif
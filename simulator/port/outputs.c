@@ -0,0 +1,114 @@
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "esp_log.h"
+#include "peripherals/outputs.h"
+#include "outputs_recorder.h"
+#include "fan_plant.h"
+
+
+#define MAX_TRANSITIONS 1024
+
+
+static const char *TAG = "Outputs";
+
+static const char *names[OUTPUT_NUM] = {
+    [OUTPUT_HAP]       = "HAP",
+    [OUTPUT_PWM]       = "PWM",
+    [OUTPUT_LED_GREEN] = "Green LED",
+    [OUTPUT_LED_RED]   = "Red LED",
+};
+
+/*
+ *  Same shadow state as the hardware driver, but every write that would reach the hardware is recorded with its
+ *  timestamp instead and drives the fan plant. The oldest transitions are dropped once the buffer is full.
+ */
+static uint32_t             shadow[OUTPUT_NUM]     = {0};
+static uint8_t              valid[OUTPUT_NUM]      = {0};
+static outputs_statistics_t statistics[OUTPUT_NUM] = {0};
+static outputs_transition_t transitions[MAX_TRANSITIONS];
+static size_t               first = 0;
+static size_t               count = 0;
+
+
+void outputs_init(void) {
+    ESP_LOGI(TAG, "Recording output transitions");
+}
+
+
+uint8_t outputs_set(output_t output, uint32_t value) {
+    if (valid[output] && shadow[output] == value) {
+        statistics[output].suppressed++;
+        return 0;
+    }
+
+    shadow[output] = value;
+    valid[output]  = 1;
+    statistics[output].written++;
+
+    // The simulated fan follows the motor outputs
+    if (output == OUTPUT_PWM) {
+        fan_plant_set_duty(value);
+    } else if (output == OUTPUT_HAP) {
+        fan_plant_set_enabled((uint8_t)value);
+    }
+
+    outputs_transition_t transition = {
+        .timestamp = (uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS),
+        .output    = output,
+        .value     = value,
+    };
+    if (count < MAX_TRANSITIONS) {
+        transitions[(first + count) % MAX_TRANSITIONS] = transition;
+        count++;
+    } else {
+        transitions[first] = transition;
+        first              = (first + 1) % MAX_TRANSITIONS;
+    }
+
+    return 1;
+}
+
+
+void outputs_invalidate(output_t output) {
+    valid[output] = 0;
+}
+
+
+void outputs_get_statistics(output_t output, outputs_statistics_t *result) {
+    *result = statistics[output];
+}
+
+
+void outputs_reset_statistics(void) {
+    memset(statistics, 0, sizeof(statistics));
+}
+
+
+const char *outputs_name(output_t output) {
+    return names[output];
+}
+
+
+size_t outputs_recorder_count(void) {
+    return count;
+}
+
+
+/*
+ * Transitions are indexed from the oldest still recorded
+ */
+int outputs_recorder_get(size_t index, outputs_transition_t *transition) {
+    if (index >= count) {
+        return -1;
+    }
+
+    *transition = transitions[(first + index) % MAX_TRANSITIONS];
+    return 0;
+}
+
+
+void outputs_recorder_clear(void) {
+    first = 0;
+    count = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef OUTPUTS_RECORDER_H_INCLUDED
+#define OUTPUTS_RECORDER_H_INCLUDED
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "peripherals/outputs.h"
+
+
+typedef struct {
+    uint32_t timestamp;     // ms since the scheduler started
+    output_t output;
+    uint32_t value;
+} outputs_transition_t;
+
+
+size_t outputs_recorder_count(void);
+int    outputs_recorder_get(size_t index, outputs_transition_t *transition);
+void   outputs_recorder_clear(void);
+
+
+#endif
@@ -3,195 +3,550 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#ifndef __MINGW32__
+#include <unistd.h>
+#endif
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "cJSON.h"
 #include "b64.h"
 #include "simulator/cJSON/cJSON.h"
 
 
-#define DATABASE_FILE ".simulator_db.json"
+#define DATABASE_FILE     ".simulator_db.json"
+#define DATABASE_TMP_FILE ".simulator_db.json.tmp"
+#define JOURNAL_FILE      ".simulator_db.journal"
+
+#define KEY_SIZE 16
+// Initial number of buckets; the table doubles whenever it gets half full
+#define INITIAL_BUCKETS 64
+// The journal is folded back into the database once it holds this many records more than there are keys
+#define COMPACTION_THRESHOLD 256
+
+
+typedef enum {
+    ENTRY_EMPTY = 0,
+    ENTRY_NUMBER,
+    ENTRY_BLOB,
+} entry_type_t;
+
+
+typedef struct {
+    char     key[KEY_SIZE];
+    uint8_t  type;
+    double   number;
+    uint8_t *blob;
+    size_t   len;
+} entry_t;
+
+
+static int      load_number(double *value, char *key);
+static int      save_number(double value, char *key);
+static entry_t *lookup(const char *key, uint8_t create);
+static void     grow(void);
+static void     load_database(void);
+static void     replay_journal(void);
+static int      append_journal(entry_t *entry);
+static char    *read_line(FILE *f, char **line, size_t *capacity);
+static void     compact(void);
+static uint32_t checksum(const char *string, size_t len);
+
+
+/*
+ *  The database is read once at startup into an open addressing hash table. Every save appends a record to the
+ *  journal; a record is only trusted if it is complete and its checksum matches, so a crash in the middle of a
+ *  write loses that write only. Once the journal grows large enough it is folded into the database file, which is
+ *  replaced atomically, and truncated.
+ */
+static SemaphoreHandle_t sem;
+static entry_t          *table   = NULL;
+static size_t            buckets = 0;
+static size_t            entries = 0;
+static FILE             *journal = NULL;
+static size_t            records = 0;
+static unsigned int      depth   = 0;
+static uint8_t           failed  = 0;
+
+
+void storage_init(void) {
+    static StaticSemaphore_t semaphore_buffer;
+    sem = xSemaphoreCreateRecursiveMutexStatic(&semaphore_buffer);
+
+    buckets = INITIAL_BUCKETS;
+    table   = calloc(buckets, sizeof(entry_t));
+    assert(table != NULL);
+
+    load_database();
+    replay_journal();
+
+    journal = fopen(JOURNAL_FILE, "a");
+    if (journal == NULL) {
+        printf("Non sono riuscito ad aprire il journal\n");
+    }
+
+    printf("Storage: %zu chiavi, %zu record nel journal\n", entries, records);
+    atexit(compact);
+}
 
 
-static char database_read[10000] = {0};
+void storage_begin(void) {
+    xSemaphoreTakeRecursive(sem, portMAX_DELAY);
+    depth++;
+}
 
 
-static cJSON *read_database();
-static void   write_database(cJSON *json);
-static int    load_number(double *value, char *key);
-static int    save_number(double value, char *key);
+int storage_commit(void) {
+    int res = 0;
 
+    assert(depth > 0);
+    if (--depth == 0) {
+        if (journal != NULL && fflush(journal) != 0) {
+            failed = 1;
+        }
+        if (records > entries + COMPACTION_THRESHOLD) {
+            compact();
+        }
 
-void storage_init(void) {}
+        res    = failed ? -1 : 0;
+        failed = 0;
+    }
+
+    xSemaphoreGiveRecursive(sem);
+    return res;
+}
 
 
 int storage_load_double(double *value, char *key) {
     double number = 0;
-    if (load_number(&number, key)) {
-        return -1;
-    } else {
+    int    res    = load_number(&number, key);
+    if (res == 0) {
         *value = (double)number;
-        return 0;
     }
+    return res;
 }
 
 
-void storage_save_double(double *value, char *key) {
-    save_number(*value, key);
+int storage_save_double(double *value, char *key) {
+    return save_number(*value, key);
 }
 
 
 int storage_load_uint8(uint8_t *value, char *key) {
     double number = 0;
-    if (load_number(&number, key)) {
-        return -1;
-    } else {
+    int    res    = load_number(&number, key);
+    if (res == 0) {
         *value = (uint8_t)number;
-        return 0;
     }
+    return res;
 }
 
 
-void storage_save_uint8(uint8_t *value, char *key) {
-    save_number((double)*value, key);
+int storage_save_uint8(uint8_t *value, char *key) {
+    return save_number((double)*value, key);
 }
 
 
 int storage_load_uint16(uint16_t *value, char *key) {
     double number = 0;
-    if (load_number(&number, key)) {
-        return -1;
-    } else {
-        *value = (uint8_t)number;
-        return 0;
+    int    res    = load_number(&number, key);
+    if (res == 0) {
+        *value = (uint16_t)number;
     }
+    return res;
 }
 
 
-void storage_save_uint16(uint16_t *value, char *key) {
-    save_number((double)*value, key);
+int storage_save_uint16(uint16_t *value, char *key) {
+    return save_number((double)*value, key);
 }
 
 
 int storage_load_uint32(uint32_t *value, char *key) {
     double number = 0;
-    if (load_number(&number, key)) {
-        return -1;
-    } else {
+    int    res    = load_number(&number, key);
+    if (res == 0) {
         *value = (uint32_t)number;
-        return 0;
     }
+    return res;
 }
 
 
-void storage_save_uint32(uint32_t *value, char *key) {
-    save_number((double)*value, key);
+int storage_save_uint32(uint32_t *value, char *key) {
+    return save_number((double)*value, key);
 }
 
 
 int storage_load_uint64(uint64_t *value, char *key) {
     double number = 0;
-    if (load_number(&number, key)) {
-        return -1;
-    } else {
-        *value = (uint8_t)number;
-        return 0;
+    int    res    = load_number(&number, key);
+    if (res == 0) {
+        *value = (uint64_t)number;
     }
+    return res;
 }
 
 
-void storage_save_uint64(uint64_t *value, char *key) {
-    save_number(*value, key);
+int storage_save_uint64(uint64_t *value, char *key) {
+    return save_number(*value, key);
 }
 
 
 int storage_load_blob(void *value, size_t len, char *key) {
-    cJSON *json    = read_database();
-    cJSON *encoded = cJSON_GetObjectItemCaseSensitive(json, key);
-    if (!cJSON_IsString(encoded)) {
-        printf("Mi aspettavo una stringa (b64) per %s\n", key);
-        cJSON_free(encoded);
-        cJSON_free(json);
-        return -1;
+    int res = 0;
+
+    xSemaphoreTakeRecursive(sem, portMAX_DELAY);
+    entry_t *entry = lookup(key, 0);
+    if (entry == NULL) {
+        res = 1;
+    } else if (entry->type != ENTRY_BLOB) {
+        printf("Mi aspettavo un blob per %s\n", key);
+        res = -1;
     } else {
-        unsigned char *decoded = b64_decode_ex((const char *)encoded->valuestring, strlen(encoded->valuestring), NULL);
-        memcpy(value, decoded, len);
-        cJSON_free(encoded);
-        cJSON_free(json);
-        free(decoded);
-        return 0;
+        memcpy(value, entry->blob, entry->len < len ? entry->len : len);
+    }
+    xSemaphoreGiveRecursive(sem);
+
+    return res;
+}
+
+
+int storage_save_blob(void *value, size_t len, char *key) {
+    assert(strlen(key) < KEY_SIZE);
+
+    storage_begin();
+    entry_t *entry = lookup(key, 1);
+    uint8_t *blob  = malloc(len > 0 ? len : 1);
+    assert(blob != NULL);
+    memcpy(blob, value, len);
+
+    if (entry->type == ENTRY_BLOB) {
+        free(entry->blob);
+    }
+    entry->type = ENTRY_BLOB;
+    entry->blob = blob;
+    entry->len  = len;
+
+    if (append_journal(entry)) {
+        failed = 1;
     }
+    return storage_commit();
 }
 
 
-void storage_save_blob(void *value, size_t len, char *key) {
-    char * encoded = b64_encode((unsigned char *)value, len);
-    cJSON *json    = read_database();
-    cJSON_DeleteItemFromObjectCaseSensitive(json, key);
-    if (cJSON_AddStringToObject(json, key, encoded) == NULL) {
-        printf("Non sono riuscito ad aggiungere %s", key);
+static int load_number(double *value, char *key) {
+    int res = 0;
+
+    xSemaphoreTakeRecursive(sem, portMAX_DELAY);
+    entry_t *entry = lookup(key, 0);
+    if (entry == NULL) {
+        res = 1;
+    } else if (entry->type != ENTRY_NUMBER) {
+        printf("Mi aspettavo un numero per %s\n", key);
+        res = -1;
     } else {
-        write_database(json);
+        *value = entry->number;
     }
-    cJSON_free(json);
-    free(encoded);
+    xSemaphoreGiveRecursive(sem);
+
+    return res;
+}
+
+
+static int save_number(double value, char *key) {
+    assert(strlen(key) < KEY_SIZE);
+
+    storage_begin();
+    entry_t *entry = lookup(key, 1);
+    if (entry->type == ENTRY_BLOB) {
+        free(entry->blob);
+        entry->blob = NULL;
+    }
+    entry->type   = ENTRY_NUMBER;
+    entry->number = value;
+
+    if (append_journal(entry)) {
+        failed = 1;
+    }
+    return storage_commit();
+}
+
+
+/*
+ * Linear probing on an FNV-1a hash. Keys are never removed, so there is no need for tombstones.
+ */
+static entry_t *lookup(const char *key, uint8_t create) {
+    if (create && (entries + 1) * 2 > buckets) {
+        grow();
+    }
+
+    size_t index = checksum(key, strlen(key)) & (buckets - 1);
+    while (table[index].type != ENTRY_EMPTY) {
+        if (strcmp(table[index].key, key) == 0) {
+            return &table[index];
+        }
+        index = (index + 1) & (buckets - 1);
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    // A fresh entry is only half built: the caller sets its type right away
+    strncpy(table[index].key, key, KEY_SIZE - 1);
+    table[index].blob = NULL;
+    table[index].len  = 0;
+    entries++;
+    return &table[index];
+}
+
+
+static void grow(void) {
+    entry_t *old         = table;
+    size_t   old_buckets = buckets;
+
+    buckets *= 2;
+    table = calloc(buckets, sizeof(entry_t));
+    assert(table != NULL);
+
+    for (size_t i = 0; i < old_buckets; i++) {
+        if (old[i].type != ENTRY_EMPTY) {
+            size_t index = checksum(old[i].key, strlen(old[i].key)) & (buckets - 1);
+            while (table[index].type != ENTRY_EMPTY) {
+                index = (index + 1) & (buckets - 1);
+            }
+            table[index] = old[i];
+        }
+    }
+
+    free(old);
 }
 
 
-static cJSON *read_database() {
+static void load_database(void) {
     FILE *f = fopen(DATABASE_FILE, "r");
     if (f == NULL) {
         printf("Database file non trovato\n");
-        return cJSON_Parse("{}");
+        return;
     }
 
     fseek(f, 0, SEEK_END);
     long fsize = ftell(f);
     fseek(f, 0, SEEK_SET); /* same as rewind(f); */
 
-    fread(database_read, 1, fsize, f);
+    char *content = malloc(fsize + 1);
+    assert(content != NULL);
+    size_t read   = fread(content, 1, fsize, f);
+    content[read] = '\0';
     fclose(f);
-    return cJSON_Parse(database_read);
+
+    cJSON *json = cJSON_Parse(content);
+    free(content);
+    if (json == NULL) {
+        printf("Database corrotto\n");
+        return;
+    }
+
+    cJSON *item = NULL;
+    cJSON_ArrayForEach(item, json) {
+        if (strlen(item->string) >= KEY_SIZE) {
+            continue;
+        }
+
+        if (cJSON_IsNumber(item)) {
+            entry_t *entry = lookup(item->string, 1);
+            entry->type    = ENTRY_NUMBER;
+            entry->number  = item->valuedouble;
+        } else if (cJSON_IsString(item)) {
+            size_t   len     = 0;
+            uint8_t *decoded = b64_decode_ex(item->valuestring, strlen(item->valuestring), &len);
+            entry_t *entry   = lookup(item->string, 1);
+            entry->type      = ENTRY_BLOB;
+            entry->blob      = decoded;
+            entry->len       = len;
+        }
+    }
+
+    cJSON_Delete(json);
 }
 
 
-static void write_database(cJSON *json) {
-    FILE *f = fopen(DATABASE_FILE, "w");
+/*
+ * Journal records are single lines: `N <key> <number> <checksum>` or `B <key> <base64> <checksum>`, with the
+ * checksum computed over everything that precedes it. Replay stops at the first torn or corrupted record.
+ */
+static void replay_journal(void) {
+    FILE *f = fopen(JOURNAL_FILE, "r");
     if (f == NULL) {
-        printf("Non sono riuscito a scrivere il database\n");
         return;
     }
 
-    char *string = cJSON_Print(json);
-    fwrite(string, 1, strlen(string), f);
-    free(string);
+    char  *line     = NULL;
+    size_t capacity = 0;
+    long   valid    = 0;
+
+    while (read_line(f, &line, &capacity) != NULL) {
+
+        char *separator = strrchr(line, ' ');
+        if (separator == NULL || strtoul(separator + 1, NULL, 16) != checksum(line, separator - line)) {
+            break;
+        }
+        *separator = '\0';
+
+        char  type  = line[0];
+        char *key   = strtok(line + 1, " ");
+        char *value = strtok(NULL, " ");
+        if ((type != 'N' && type != 'B') || key == NULL || value == NULL || strlen(key) >= KEY_SIZE) {
+            break;
+        }
+
+        entry_t *entry = lookup(key, 1);
+        if (entry->type == ENTRY_BLOB) {
+            free(entry->blob);
+            entry->blob = NULL;
+        }
+        if (type == 'N') {
+            entry->type   = ENTRY_NUMBER;
+            entry->number = strtod(value, NULL);
+        } else {
+            entry->type = ENTRY_BLOB;
+            entry->blob = b64_decode_ex(value, strlen(value), &entry->len);
+        }
+
+        records++;
+        valid = ftell(f);
+    }
+
+    free(line);
     fclose(f);
+
+#ifndef __MINGW32__
+    // Drop the torn tail, otherwise later records would be appended after it and never replayed
+    if (truncate(JOURNAL_FILE, valid)) {
+        printf("Non sono riuscito a troncare il journal\n");
+    }
+#else
+    (void)valid;
+#endif
 }
 
 
-static int load_number(double *value, char *key) {
-    cJSON *json   = read_database();
-    cJSON *number = cJSON_GetObjectItemCaseSensitive(json, key);
-    if (!cJSON_IsNumber(number)) {
-        printf("Mi aspettavo un numero per %s\n", key);
-        cJSON_free(number);
-        cJSON_free(json);
+static int append_journal(entry_t *entry) {
+    char *encoded = NULL;
+    char  number[32];
+    char *value = number;
+
+    if (journal == NULL) {
         return -1;
+    }
+
+    if (entry->type == ENTRY_NUMBER) {
+        snprintf(number, sizeof(number), "%.17g", entry->number);
     } else {
-        cJSON_free(json);
-        *value = number->valuedouble;
-        return 0;
+        encoded = b64_encode(entry->blob, entry->len);
+        value   = encoded;
     }
+
+    size_t len  = strlen(entry->key) + strlen(value) + 3;
+    char  *line = malloc(len + 1);
+    assert(line != NULL);
+    snprintf(line, len + 1, "%c %s %s", entry->type == ENTRY_NUMBER ? 'N' : 'B', entry->key, value);
+    free(encoded);
+
+    // Flushed by storage_commit, once per session
+    int res = fprintf(journal, "%s %08x\n", line, (unsigned)checksum(line, len)) < 0 ? -1 : 0;
+    free(line);
+
+    records++;
+    return res;
 }
 
-static int save_number(double value, char *key) {
-    cJSON *json = read_database();
-    cJSON_DeleteItemFromObjectCaseSensitive(json, key);
-    if (cJSON_AddNumberToObject(json, key, value) == NULL) {
-        printf("Non sono riuscito ad aggiungere %s\n", key);
-        cJSON_free(json);
-        return -1;
-    } else {
-        write_database(json);
-        cJSON_free(json);
-        return 0;
+
+/*
+ * Reads a whole line, without the newline; NULL if there is none or it was not terminated
+ */
+static char *read_line(FILE *f, char **line, size_t *capacity) {
+    size_t len = 0;
+    int    c   = 0;
+
+    while ((c = fgetc(f)) != EOF) {
+        if (len + 1 >= *capacity) {
+            *capacity = *capacity > 0 ? *capacity * 2 : 128;
+            *line     = realloc(*line, *capacity);
+            assert(*line != NULL);
+        }
+        if (c == '\n') {
+            (*line)[len] = '\0';
+            return *line;
+        }
+        (*line)[len++] = (char)c;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Writes the whole table to a temporary file, then renames it over the database. The journal is truncated only
+ * afterwards: a crash in between replays it on top of a database that already contains it, which is harmless.
+ */
+static void compact(void) {
+    cJSON *json = cJSON_CreateObject();
+
+    for (size_t i = 0; i < buckets; i++) {
+        entry_t *entry = &table[i];
+        if (entry->type == ENTRY_NUMBER) {
+            cJSON_AddNumberToObject(json, entry->key, entry->number);
+        } else if (entry->type == ENTRY_BLOB) {
+            char *encoded = b64_encode(entry->blob, entry->len);
+            cJSON_AddStringToObject(json, entry->key, encoded);
+            free(encoded);
+        }
+    }
+
+    char *string = cJSON_Print(json);
+    cJSON_Delete(json);
+
+    FILE *f = fopen(DATABASE_TMP_FILE, "w");
+    if (f == NULL) {
+        printf("Non sono riuscito a scrivere il database\n");
+        free(string);
+        return;
+    }
+    size_t len     = strlen(string);
+    int    written = fwrite(string, 1, len, f) == len && fflush(f) == 0;
+#ifndef __MINGW32__
+    written = written && fsync(fileno(f)) == 0;
+#endif
+    fclose(f);
+    free(string);
+
+    if (!written) {
+        printf("Non sono riuscito a scrivere il database\n");
+        remove(DATABASE_TMP_FILE);
+        return;
+    }
+
+#ifdef __MINGW32__
+    // rename does not replace an existing file on Windows
+    remove(DATABASE_FILE);
+#endif
+    if (rename(DATABASE_TMP_FILE, DATABASE_FILE)) {
+        printf("Non sono riuscito a sostituire il database\n");
+        return;
+    }
+
+    if (journal != NULL) {
+        fclose(journal);
+    }
+    journal = fopen(JOURNAL_FILE, "w");
+    records = 0;
+}
+
+
+static uint32_t checksum(const char *string, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)string[i]) * 16777619u;
     }
+    return hash;
 }
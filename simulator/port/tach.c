@@ -0,0 +1,108 @@
+#include <math.h>
+#include <time.h>
+#include "esp_log.h"
+#include "peripherals/tach.h"
+#include "fan_plant.h"
+
+
+// Same as the firmware's LEDC resolution
+#define DUTY_MAX 8192
+// Fan integration step
+#define STEP_US 1000
+
+#define PI 3.14159265358979323846
+
+
+static void    advance(int64_t now);
+static int64_t now_us(void);
+
+
+static const char *TAG = "Tach";
+
+/*
+ *  Fan plant: a first order lag towards the steady state speed for the power let through by the phase cut.
+ *  Airflow load makes power grow with the cube of the speed, so the speed follows the cube root of the power;
+ *  `load` scales it, to check how the loop copes with a clogged filter or a different supply.
+ */
+static struct {
+    uint32_t duty;
+    uint8_t  enabled;
+    double   load;
+    double   max_rpm;
+    double   time_constant;     // s
+    double   rpm;
+    double   revolutions;
+    int64_t  time;
+} plant = {.load = 1.0, .max_rpm = 3000, .time_constant = 2.0};
+
+static tach_reading_t reading = {0};
+
+
+void tach_init(void) {
+    plant.time = now_us();
+    ESP_LOGI(TAG, "Simulated fan, %.0f rpm, %.1f s", plant.max_rpm, plant.time_constant);
+}
+
+
+void tach_read(tach_reading_t *result) {
+    advance(now_us());
+    *result = reading;
+}
+
+
+void fan_plant_set_duty(uint32_t duty) {
+    advance(now_us());
+    plant.duty = duty > DUTY_MAX ? DUTY_MAX : duty;
+}
+
+
+void fan_plant_set_enabled(uint8_t enabled) {
+    advance(now_us());
+    plant.enabled = enabled;
+}
+
+
+void fan_plant_set_load(uint16_t permille) {
+    advance(now_us());
+    plant.load = permille / 1000.;
+}
+
+
+void fan_plant_set_parameters(uint16_t max_rpm, uint32_t time_constant_ms) {
+    advance(now_us());
+    plant.max_rpm       = max_rpm;
+    plant.time_constant = time_constant_ms / 1000.;
+}
+
+
+static void advance(int64_t now) {
+    if (plant.time == 0) {
+        plant.time = now;
+    }
+
+    // Conduction from the firing angle to the end of the half wave
+    double conduction = plant.enabled ? (double)plant.duty / DUTY_MAX : 0;
+    double angle      = PI * (1 - conduction);
+    double power      = (PI - angle + sin(2 * angle) / 2) / PI;
+    double target     = plant.max_rpm * cbrt(power) * plant.load;
+
+    while (now - plant.time >= STEP_US) {
+        plant.time += STEP_US;
+        plant.rpm += (target - plant.rpm) * (STEP_US / 1e6) / plant.time_constant;
+
+        double previous = plant.revolutions;
+        plant.revolutions += plant.rpm / 60 * (STEP_US / 1e6);
+        // Two pulses per revolution
+        if (floor(plant.revolutions * 2) != floor(previous * 2)) {
+            reading.pulses++;
+            reading.last_edge_us = plant.time;
+        }
+    }
+}
+
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
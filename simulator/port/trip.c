@@ -0,0 +1,163 @@
+#include <time.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "esp_log.h"
+#include "peripherals/trip.h"
+#include "peripherals/outputs.h"
+#include "trip_injector.h"
+
+
+// Same as the firmware
+#define REARM_DELAY_US 100000LL
+
+
+static void    trip_handler(void);
+static void    apply_output(uint8_t level);
+static int64_t now_ns(void);
+
+
+static const char *TAG = "Trip";
+
+/*
+ *  Same latch as the firmware, with the opening edge of the safety input injected by tests instead of coming from
+ *  a GPIO interrupt. Cutting HAP_OUTPUT is enough to stop the simulated fan, so the PWM pin is not detached.
+ */
+static uint8_t           armed       = 1;
+static uint8_t           latched     = 0;
+static uint8_t           confirmed   = 0;
+static int64_t           trip_time   = 0;
+static TaskHandle_t      notify_task = NULL;
+static uint32_t          notify_bits = 0;
+static trip_statistics_t statistics  = {0};
+// Level requested for the next zero crossing, -1 if none
+static int8_t  pending_level = -1;
+static int64_t pending_since = 0;
+static uint8_t output_level  = 0;
+
+
+void trip_init(uint32_t signal) {
+    (void)signal;
+    ESP_LOGI(TAG, "Waiting for injected edges");
+}
+
+
+void trip_set_notification(TaskHandle_t task, uint32_t bits) {
+    notify_bits = bits;
+    notify_task = task;
+}
+
+
+void trip_set_armed(uint8_t value) {
+    armed = value;
+    if (!armed) {
+        latched = 0;
+    }
+}
+
+
+void trip_confirm(void) {
+    if (latched && !confirmed) {
+        confirmed                  = 1;
+        statistics.last_confirm_ms = (uint32_t)((now_ns() - trip_time) / 1000000);
+    }
+}
+
+
+void trip_rearm(void) {
+    if (latched && now_ns() - trip_time >= REARM_DELAY_US * 1000) {
+        latched = 0;
+    }
+}
+
+
+uint8_t trip_is_latched(void) {
+    return latched;
+}
+
+
+void trip_set_output(uint8_t level) {
+    pending_level = -1;
+    if (!level || !latched) {
+        outputs_set(OUTPUT_HAP, level);
+        output_level = level;
+    }
+}
+
+
+void trip_set_output_synchronized(uint8_t level) {
+    if (level == output_level || (level && latched)) {
+        pending_level = -1;
+    } else if (pending_level != level) {
+        pending_level = level;
+        pending_since = now_ns();
+    }
+}
+
+
+void trip_flush_output(int64_t timeout_us) {
+    if (pending_level >= 0 && now_ns() - pending_since >= timeout_us * 1000) {
+        apply_output(pending_level);
+        pending_level = -1;
+    }
+}
+
+
+void trip_zero_cross(void) {
+    if (pending_level >= 0) {
+        apply_output(pending_level);
+        pending_level = -1;
+    }
+}
+
+
+void trip_get_statistics(trip_statistics_t *result) {
+    *result = statistics;
+}
+
+
+/*
+ * Opens the safety contact: runs the trip handler right away, as the GPIO interrupt would
+ */
+void trip_injector_open(void) {
+    trip_handler();
+}
+
+
+static void trip_handler(void) {
+    int64_t start = now_ns();
+
+    if (armed && !latched) {
+        outputs_set(OUTPUT_HAP, 0);
+        output_level  = 0;
+        pending_level = -1;
+
+        uint32_t elapsed           = (uint32_t)(now_ns() - start);
+        latched                    = 1;
+        confirmed                  = 0;
+        trip_time                  = start;
+        statistics.last_handler_ns = elapsed;
+        if (elapsed > statistics.max_handler_ns) {
+            statistics.max_handler_ns = elapsed;
+        }
+        statistics.count++;
+
+        if (notify_task != NULL) {
+            xTaskNotify(notify_task, notify_bits, eSetBits);
+        }
+    }
+}
+
+
+static void apply_output(uint8_t level) {
+    if (!level || !latched) {
+        outputs_set(OUTPUT_HAP, level);
+        output_level = level;
+    }
+}
+
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
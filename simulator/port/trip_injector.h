@@ -0,0 +1,8 @@
+#ifndef TRIP_INJECTOR_H_INCLUDED
+#define TRIP_INJECTOR_H_INCLUDED
+
+
+void trip_injector_open(void);
+
+
+#endif
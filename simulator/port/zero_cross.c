@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <time.h>
+#include "esp_log.h"
+#include "peripherals/zero_cross.h"
+#include "zero_cross_generator.h"
+
+
+static int64_t now_us(void);
+
+
+static const char *TAG = "ZeroCross";
+
+/*
+ *  Synthetic mains: crossings are generated lazily, up to the current time, whenever they are read. Each edge is
+ *  moved by up to +-jitter_us and dropped with the given probability, like a noisy detector would.
+ */
+static uint32_t          frequency     = 50;
+static uint32_t          jitter        = 100;
+static uint32_t          missing       = 0;
+static int64_t           next_crossing = 0;
+static uint64_t          crossings     = 0;
+static zero_cross_hook_t hook          = NULL;
+
+
+void zero_cross_init(void) {
+    next_crossing = now_us();
+    ESP_LOGI(TAG, "Generating %u Hz crossings", (unsigned)frequency);
+}
+
+
+void zero_cross_generator_set(uint32_t frequency_hz, uint32_t jitter_us, uint32_t missing_permille) {
+    frequency = frequency_hz;
+    jitter    = jitter_us;
+    missing   = missing_permille;
+    ESP_LOGI(TAG, "Generating %u Hz crossings, jitter %u us, %u/1000 missing", (unsigned)frequency,
+             (unsigned)jitter, (unsigned)missing);
+}
+
+
+void zero_cross_set_hook(zero_cross_hook_t function) {
+    hook = function;
+}
+
+
+size_t zero_cross_read(int64_t *timestamps, size_t max) {
+    int64_t now   = now_us();
+    size_t  count = 0;
+
+    if (next_crossing == 0) {
+        next_crossing = now;
+    }
+
+    while (next_crossing <= now && count < max) {
+        int64_t ideal = next_crossing;
+        crossings++;
+        // Computed from the crossing count so that the rounding does not accumulate
+        next_crossing = ideal + (int64_t)((crossings * 500000) / frequency - ((crossings - 1) * 500000) / frequency);
+
+        if ((uint32_t)(rand() % 1000) < missing) {
+            continue;
+        }
+
+        int64_t offset = jitter > 0 ? (int64_t)(rand() % (2 * jitter + 1)) - jitter : 0;
+        if (hook != NULL) {
+            hook();
+        }
+        timestamps[count++] = ideal + offset;
+    }
+
+    return count;
+}
+
+
+uint32_t zero_cross_get_overruns(void) {
+    return 0;
+}
+
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,11 @@
+#ifndef ZERO_CROSS_GENERATOR_H_INCLUDED
+#define ZERO_CROSS_GENERATOR_H_INCLUDED
+
+
+#include <stdint.h>
+
+
+void zero_cross_generator_set(uint32_t frequency_hz, uint32_t jitter_us, uint32_t missing_permille);
+
+
+#endif
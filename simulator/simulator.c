@@ -4,6 +4,8 @@
 
 #include "model/model.h"
 #include "controller/controller.h"
+#include "controller/phase.h"
+#include "peripherals/storage.h"
 
 
 static const char *TAG = "Main";
@@ -13,13 +15,18 @@ void app_main(void *arg) {
     model_t model;
     (void)arg;
 
+    storage_init();
     model_init(&model);
     // view_init(&model);
     controller_init(&model);
 
     ESP_LOGI(TAG, "Begin main loop");
     for (;;) {
-        ESP_LOGI(TAG, "Hello simulated world!");
+        // The controller feeds the estimator from the synthetic crossings
+        phase_statistics_t phase = {0};
+        phase_get_statistics(&phase);
+        ESP_LOGI(TAG, "Phase locked=%i half period=%uus jitter=%uus max=%uus", phase.locked,
+                 (unsigned)phase.halfperiod_us, (unsigned)phase.jitter_us, (unsigned)phase.max_jitter_us);
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
 
@@ -0,0 +1,177 @@
+#!/usr/bin/env python
+"""
+Times the model accessors one controller_manage pass goes through (ten scalar reads and the class), built on the
+host for two revisions of main/model: by default the last one whose GETTER took the model mutex and the working
+tree. The FreeRTOS mutex is replaced by a pthread one, so the figures only show the relative cost of the two
+approaches, not the cycles on the target.
+
+The EasyConnect headers are looked up in the components submodules; other include directories can be added.
+
+Usage: python tools/bench_model.py [--cc CC] [--before REV] [-I DIR ...]
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+MAIN = os.path.join(ROOT, "main")
+COMPONENTS = os.path.join(ROOT, "components")
+PASSES = 2000000
+
+FREERTOS = """
+#ifndef FREERTOS_H_INCLUDED
+#define FREERTOS_H_INCLUDED
+#include <stdint.h>
+#include <pthread.h>
+
+typedef void           *TaskHandle_t;
+typedef pthread_mutex_t StaticSemaphore_t;
+typedef pthread_mutex_t *SemaphoreHandle_t;
+typedef enum { eNoAction = 0, eSetBits } eNotifyAction;
+
+#define portMAX_DELAY 0xFFFFFFFFUL
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) {
+    pthread_mutex_init(buffer, NULL);
+    return buffer;
+}
+
+static inline int xSemaphoreTake(SemaphoreHandle_t sem, uint32_t timeout) {
+    (void)timeout;
+    return pthread_mutex_lock(sem) == 0;
+}
+
+static inline int xSemaphoreGive(SemaphoreHandle_t sem) {
+    return pthread_mutex_unlock(sem) == 0;
+}
+
+static inline int xTaskNotify(TaskHandle_t task, uint32_t bits, eNotifyAction action) {
+    (void)task;
+    (void)bits;
+    (void)action;
+    return 1;
+}
+#endif
+"""
+
+HEADERS = {
+    os.path.join("freertos", "FreeRTOS.h"): FREERTOS,
+    os.path.join("freertos", "semphr.h"): '#include "FreeRTOS.h"\n',
+    os.path.join("freertos", "task.h"): '#include "FreeRTOS.h"\n',
+}
+
+DRIVER = """
+#include <stdio.h>
+#include <time.h>
+#include "model/model.h"
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(void) {
+    static model_t model;
+    volatile uint32_t sink = 0;
+
+    model_init(&model);
+
+    int64_t start = now_ns();
+    for (unsigned i = 0; i < %PASSES%; i++) {
+        sink += model_get_missing_heartbeat(&model);
+        sink += model_get_safety_bypass(&model);
+        sink += model_get_motor_active(&model);
+        sink += model_get_missing_heartbeat(&model);
+        sink += model_get_safety_bypass(&model);
+        sink += model_get_motor_active(&model);
+        sink += model_get_speed_percentage(&model);
+        sink += model_get_missing_heartbeat(&model);
+        sink += model_get_motor_active(&model);
+        sink += model_get_address(&model);
+        sink += model_get_class(&model);
+    }
+    int64_t elapsed = now_ns() - start;
+
+    printf("%.1f\\n", (double)elapsed / %PASSES%);
+    return 0;
+}
+"""
+
+
+def component_includes():
+    """Directories holding the EasyConnect and lightmodbus headers in the submodules"""
+    includes = []
+    for path, dirs, files in os.walk(COMPONENTS):
+        if "easyconnect_interface.h" in files or ("lightmodbus" in dirs and "test" not in path):
+            includes.append(path)
+    return includes
+
+
+def git_show(revision, path):
+    return subprocess.run(["git", "-C", ROOT, "show", f"{revision}:{path}"], check=True, capture_output=True,
+                          text=True).stdout
+
+
+def mutex_revision():
+    """The revision right before the accessors stopped taking the mutex"""
+    commits = subprocess.run(["git", "-C", ROOT, "log", "--format=%H", "-S", "xSemaphoreTake", "--",
+                              "main/model/model.h"], check=True, capture_output=True, text=True).stdout.split()
+    if len(commits) < 2:
+        sys.exit("Cannot find the revision of model.h with the locking accessors, pass it with --before")
+    return commits[0] + "^"
+
+
+def time_pass(cc, tmp, name, model_dir, includes):
+    program = os.path.join(tmp, f"{name}.bench")
+    driver = os.path.join(tmp, "driver.c")
+    with open(driver, "w") as f:
+        f.write(DRIVER.replace("%PASSES%", str(PASSES)))
+
+    flags = ["-std=gnu99", "-O2", "-DNDEBUG", "-I", tmp, "-I", os.path.dirname(model_dir), "-I", MAIN]
+    # The model relies on the ESP-IDF headers to bring these in
+    flags += ["-include", "assert.h", "-include", "stdio.h"]
+    for include in includes:
+        flags += ["-I", include]
+    subprocess.run([cc] + flags + [driver, os.path.join(model_dir, "model.c"), "-o", program, "-lpthread"],
+                   check=True)
+    return float(subprocess.run([program], check=True, capture_output=True, text=True).stdout)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Time the model accessors of a control loop pass")
+    parser.add_argument("--cc", default=os.environ.get("CC", "cc"))
+    parser.add_argument("--before", help="revision to compare the working tree with")
+    parser.add_argument("-I", dest="includes", action="append", default=[], help="additional include directory")
+    args = parser.parse_args()
+
+    before = args.before or mutex_revision()
+    includes = args.includes + component_includes()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, content in HEADERS.items():
+            path = os.path.join(tmp, name)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, "w") as f:
+                f.write(content)
+
+        # Kept under a "model" directory, so that the driver includes either version the same way
+        old = os.path.join(tmp, "before", "model")
+        os.makedirs(old)
+        for name in ("model.c", "model.h"):
+            with open(os.path.join(old, name), "w") as f:
+                f.write(git_show(before, f"main/model/{name}"))
+
+        locked = time_pass(args.cc, tmp, "before", old, includes)
+        atomic = time_pass(args.cc, tmp, "after", os.path.join(MAIN, "model"), includes)
+
+    print(f"{before}: {locked:.1f} ns per pass")
+    print(f"working tree: {atomic:.1f} ns per pass ({locked / atomic:.1f}x faster)")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+"""
+Compiles linearization_duty (main/controller/linearization.c) for the host and checks it against the
+reference curve of sine_percentage_linearization.py: the generated header must be up to date, the duty
+must follow the interpolated table within one count, never decrease, and hit 0 and the maximum at the ends.
+
+Usage: python tools/check_linearization.py [cc]
+"""
+import os
+import subprocess
+import sys
+import tempfile
+
+import sine_percentage_linearization as reference
+
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+CONTROLLER = os.path.join(ROOT, "main", "controller")
+DUTY_MAX = 1 << 13
+# In duty counts: the firmware interpolates the delay in whole table units and rounds the duty
+TOLERANCE = 1
+
+DRIVER = """
+#include <stdio.h>
+#include "linearization.h"
+
+int main(void) {
+    for (unsigned permille = 0; permille <= 1000; permille++) {
+        printf("%u\\n", (unsigned)linearization_duty(permille, %DUTY_MAX%));
+    }
+    return 0;
+}
+"""
+
+
+def expected_duty(permille, table):
+    if permille == 0:
+        return 0
+    position = permille * reference.PIECES / 1000
+    index = int(position)
+    if index >= reference.PIECES:
+        return DUTY_MAX
+    delay = table[index] + (table[index + 1] - table[index]) * (position - index)
+    return (reference.MAXIMUM - delay) * DUTY_MAX / reference.MAXIMUM
+
+
+def compiled_duties(cc):
+    with tempfile.TemporaryDirectory() as tmp:
+        driver = os.path.join(tmp, "driver.c")
+        program = os.path.join(tmp, "linearization")
+        with open(driver, "w") as f:
+            f.write(DRIVER.replace("%DUTY_MAX%", str(DUTY_MAX)))
+
+        subprocess.run([cc, "-std=c99", "-Wall", "-Werror", "-I", CONTROLLER, driver,
+                        os.path.join(CONTROLLER, "linearization.c"), "-o", program], check=True)
+        output = subprocess.run([program], check=True, capture_output=True, text=True).stdout
+        return [int(line) for line in output.split()]
+
+
+def main():
+    cc = sys.argv[1] if len(sys.argv) > 1 else os.environ.get("CC", "cc")
+    errors = []
+
+    with open(os.path.join(CONTROLLER, "sine_linearization.h")) as f:
+        if f.read() != reference.header():
+            errors.append("sine_linearization.h is not up to date with sine_percentage_linearization.py")
+
+    table = reference.table()
+    duties = compiled_duties(cc)
+
+    if duties[0] != 0:
+        errors.append(f"0 permille gives duty {duties[0]} instead of 0")
+    if duties[1000] != DUTY_MAX:
+        errors.append(f"1000 permille gives duty {duties[1000]} instead of {DUTY_MAX}")
+
+    for permille, duty in enumerate(duties):
+        expected = expected_duty(permille, table)
+        if abs(duty - expected) > TOLERANCE:
+            errors.append(f"{permille} permille gives duty {duty}, expected {expected:.2f}")
+        if permille > 0 and duty < duties[permille - 1]:
+            errors.append(f"Duty decreases from {duties[permille - 1]} to {duty} at {permille} permille")
+
+    for error in errors:
+        print(error)
+    print(f"{len(duties)} points checked, {len(errors)} errors")
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,123 @@
+#!/usr/bin/env python
+"""
+Replays the output writes motor.c makes for a fan state change (on at one speed, periodic refreshes, a new speed,
+off) on the simulated outputs (simulator/port/outputs.c) and checks the transitions they record: only the writes
+that change an output may reach the hardware, in order, and the refreshes must be counted as suppressed. With a
+locked mains phase the HAP_OUTPUT change must wait for the zero crossing.
+
+Usage: python tools/check_outputs.py [cc]
+"""
+import os
+import sys
+
+import simulator_host
+
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DUTY_MAX = 1 << 13
+REFRESHES = 3
+
+DRIVER = """
+#include <stdio.h>
+#include "peripherals/trip.h"
+#include "outputs_recorder.h"
+#include "controller/linearization.h"
+
+#define CHECK(condition, message)                                                                                  \\
+    if (!(condition)) {                                                                                            \\
+        printf("error: %s\\n", message);                                                                           \\
+    }
+
+// What motor_set_state and motor_refresh write, without ramps
+static void fan_state(uint16_t permille, uint8_t active, uint8_t synchronized) {
+    if (synchronized) {
+        trip_set_output_synchronized(active);
+    } else {
+        trip_set_output(active);
+    }
+    outputs_set(OUTPUT_PWM, active ? linearization_duty(permille, %DUTY_MAX%) : 0);
+}
+
+static void print_transitions(void) {
+    outputs_transition_t transition;
+    uint32_t             previous = 0;
+
+    for (size_t i = 0; i < outputs_recorder_count(); i++) {
+        outputs_recorder_get(i, &transition);
+        CHECK(transition.timestamp >= previous, "transitions are not in time order");
+        previous = transition.timestamp;
+        printf("transition=%s %lu\\n", outputs_name(transition.output), (unsigned long)transition.value);
+    }
+}
+
+int main(void) {
+    outputs_statistics_t hap;
+    outputs_statistics_t pwm;
+
+    outputs_init();
+    trip_init(0);
+    printf("duty=%lu %lu\\n", (unsigned long)linearization_duty(600, %DUTY_MAX%),
+           (unsigned long)linearization_duty(800, %DUTY_MAX%));
+
+    fan_state(600, 1, 0);
+    for (int i = 0; i < %REFRESHES%; i++) {
+        fan_state(600, 1, 0);
+    }
+    fan_state(800, 1, 0);
+    fan_state(0, 0, 0);
+    print_transitions();
+
+    outputs_get_statistics(OUTPUT_HAP, &hap);
+    outputs_get_statistics(OUTPUT_PWM, &pwm);
+    printf("hap=%lu %lu\\n", (unsigned long)hap.written, (unsigned long)hap.suppressed);
+    printf("pwm=%lu %lu\\n", (unsigned long)pwm.written, (unsigned long)pwm.suppressed);
+
+    outputs_recorder_clear();
+    fan_state(600, 1, 1);
+    CHECK(outputs_recorder_count() == 1, "only the duty should change before the zero crossing");
+    trip_zero_cross();
+    print_transitions();
+    return 0;
+}
+"""
+
+
+def main():
+    cc = sys.argv[1] if len(sys.argv) > 1 else os.environ.get("CC", "cc")
+    driver = DRIVER.replace("%DUTY_MAX%", str(DUTY_MAX)).replace("%REFRESHES%", str(REFRESHES))
+    sources = ["trip.c", "outputs.c", os.path.join(ROOT, "main", "controller", "linearization.c")]
+    errors = []
+    transitions = []
+    counters = {}
+
+    for line in simulator_host.run(driver, sources, cc):
+        key, value = line.split("=", 1) if "=" in line else line.split(": ", 1)
+        if key == "error":
+            errors.append(value)
+        elif key == "transition":
+            transitions.append(value)
+        elif key in ("duty", "hap", "pwm"):
+            counters[key] = [int(field) for field in value.split()]
+
+    low, high = counters["duty"]
+    # On at 60%, 80%, off; then on again at 60% with the HAP_OUTPUT change held until the crossing
+    expected = ["HAP 1", f"PWM {low}", f"PWM {high}", "HAP 0", "PWM 0", f"PWM {low}", "HAP 1"]
+    if transitions != expected:
+        errors.append(f"recorded {transitions}, expected {expected}")
+
+    # The first on and the final off reach the hardware, the refreshes and the repeated HAP on do not
+    if counters.get("hap") != [2, REFRESHES + 1]:
+        errors.append(f"HAP written/suppressed {counters.get('hap')}, expected {[2, REFRESHES + 1]}")
+    if counters.get("pwm") != [3, REFRESHES]:
+        errors.append(f"PWM written/suppressed {counters.get('pwm')}, expected {[3, REFRESHES]}")
+
+    for transition in transitions:
+        print(transition)
+    for error in errors:
+        print(error)
+    print(f"{len(transitions)} transitions checked, {len(errors)} errors")
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
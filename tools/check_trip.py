@@ -0,0 +1,112 @@
+#!/usr/bin/env python
+"""
+Injects safety input openings into the simulated trip (simulator/port/trip.c) and checks, on the transitions kept
+by the simulated outputs, that HAP_OUTPUT is cut within the latency bound and that it cannot be turned back on
+until trip_rearm releases the latch, no earlier than the rearm delay.
+
+Usage: python tools/check_trip.py [cc]
+"""
+import os
+import sys
+
+import simulator_host
+
+
+# From the injected edge to the output cut; generous, since the host is not a real-time system
+LATENCY_BOUND_NS = 1000000
+NOTIFY_BITS = 0x04
+
+DRIVER = """
+#include <stdio.h>
+#include <time.h>
+#include "peripherals/trip.h"
+#include "outputs_recorder.h"
+#include "trip_injector.h"
+
+#define CHECK(condition, message)                                                                                  \\
+    if (!(condition)) {                                                                                            \\
+        printf("error: %s\\n", message);                                                                           \\
+    }
+
+static int last_hap(void) {
+    outputs_transition_t transition;
+    for (size_t i = outputs_recorder_count(); i > 0; i--) {
+        outputs_recorder_get(i - 1, &transition);
+        if (transition.output == OUTPUT_HAP) {
+            return (int)transition.value;
+        }
+    }
+    return -1;
+}
+
+int main(void) {
+    trip_statistics_t statistics;
+
+    trip_init(0);
+    trip_set_notification((TaskHandle_t)1, %NOTIFY_BITS%);
+    trip_set_output(1);
+    CHECK(last_hap() == 1 && host_plant_enabled, "the output does not turn on before the trip");
+
+    trip_injector_open();
+    size_t transitions = outputs_recorder_count();
+    trip_get_statistics(&statistics);
+    CHECK(trip_is_latched(), "the trip is not latched");
+    CHECK(last_hap() == 0 && !host_plant_enabled, "the trip does not cut the output");
+    CHECK(host_notified_bits == %NOTIFY_BITS%, "the controller is not notified");
+    CHECK(statistics.count == 1, "the trip is not counted");
+    printf("latency=%lu\\n", (unsigned long)statistics.last_handler_ns);
+
+    trip_set_output(1);
+    trip_set_output_synchronized(1);
+    trip_zero_cross();
+    trip_flush_output(0);
+    CHECK(outputs_recorder_count() == transitions, "the output is driven while the trip is latched");
+
+    trip_injector_open();
+    trip_get_statistics(&statistics);
+    CHECK(statistics.count == 1, "a second edge retriggers a latched trip");
+
+    trip_rearm();
+    CHECK(trip_is_latched(), "the trip is released before the rearm delay");
+    trip_set_output(1);
+    CHECK(last_hap() == 0, "the output turns on before the rearm delay");
+
+    struct timespec delay = {.tv_sec = 0, .tv_nsec = 110000000};
+    nanosleep(&delay, NULL);
+    CHECK(trip_is_latched(), "the trip is released without trip_rearm");
+    trip_rearm();
+    CHECK(!trip_is_latched(), "trip_rearm does not release the trip after the delay");
+    trip_set_output(1);
+    CHECK(last_hap() == 1 && host_plant_enabled, "the output does not turn on after the rearm");
+
+    trip_set_armed(0);
+    trip_injector_open();
+    CHECK(!trip_is_latched() && last_hap() == 1, "the trip fires while bypassed");
+    trip_set_armed(1);
+    return 0;
+}
+"""
+
+
+def main():
+    cc = sys.argv[1] if len(sys.argv) > 1 else os.environ.get("CC", "cc")
+    driver = DRIVER.replace("%NOTIFY_BITS%", str(NOTIFY_BITS))
+    errors = []
+
+    for line in simulator_host.run(driver, ["trip.c", "outputs.c"], cc):
+        key, value = line.split("=", 1) if "=" in line else line.split(": ", 1)
+        if key == "error":
+            errors.append(value)
+        elif key == "latency":
+            print(f"Trip latency {value} ns")
+            if int(value) > LATENCY_BOUND_NS:
+                errors.append(f"trip latency {value} ns over the {LATENCY_BOUND_NS} ns bound")
+
+    for error in errors:
+        print(error)
+    print(f"{len(errors)} errors")
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
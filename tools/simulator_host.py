@@ -0,0 +1,86 @@
+"""
+Builds simulator ports on the host without the FreeRTOS simulator, for the tools that check them. The ports only
+need the tick count and task notifications from FreeRTOS, which are replaced by the minimal headers below: a single
+thread runs the driver and the notifications are just recorded.
+"""
+import os
+import subprocess
+import tempfile
+
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+MAIN = os.path.join(ROOT, "main")
+PORT = os.path.join(ROOT, "simulator", "port")
+
+FREERTOS = """
+#ifndef FREERTOS_H_INCLUDED
+#define FREERTOS_H_INCLUDED
+#include <stdint.h>
+#include <time.h>
+
+typedef void    *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef enum { eNoAction = 0, eSetBits } eNotifyAction;
+
+#define portTICK_PERIOD_MS 1
+
+extern uint32_t host_notified_bits;
+
+static inline TickType_t xTaskGetTickCount(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static inline int xTaskNotify(TaskHandle_t task, uint32_t bits, eNotifyAction action) {
+    (void)task;
+    (void)action;
+    host_notified_bits |= bits;
+    return 1;
+}
+#endif
+"""
+
+HEADERS = {
+    "FreeRTOS.h": FREERTOS,
+    "task.h": '#include "FreeRTOS.h"\n',
+    os.path.join("freertos", "FreeRTOS.h"): '#include "../FreeRTOS.h"\n',
+    os.path.join("freertos", "task.h"): '#include "../FreeRTOS.h"\n',
+}
+
+# Fan plant calls made by the outputs port, recorded for the checks
+DRIVER_PRELUDE = """
+#include <stdint.h>
+
+uint32_t host_notified_bits = 0;
+uint32_t host_plant_duty    = 0;
+uint8_t  host_plant_enabled = 0;
+
+void fan_plant_set_duty(uint32_t duty) {
+    host_plant_duty = duty;
+}
+
+void fan_plant_set_enabled(uint8_t enabled) {
+    host_plant_enabled = enabled;
+}
+"""
+
+
+def run(driver, ports, cc):
+    """Compiles `driver` with the given simulator/port sources and returns the lines it prints"""
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, content in HEADERS.items():
+            path = os.path.join(tmp, name)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, "w") as f:
+                f.write(content)
+
+        source = os.path.join(tmp, "driver.c")
+        program = os.path.join(tmp, "driver")
+        with open(source, "w") as f:
+            f.write(DRIVER_PRELUDE + driver)
+
+        subprocess.run([cc, "-std=gnu99", "-Wall", "-Werror", "-I", tmp, "-I", PORT, "-I", MAIN, source] +
+                       [os.path.join(PORT, port) for port in ports] + ["-o", program], check=True)
+        output = subprocess.run([program], check=True, capture_output=True, text=True).stdout
+        return output.splitlines()
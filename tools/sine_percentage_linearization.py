@@ -1,4 +1,5 @@
 import math
+import sys
 
 
 def find_closest(value, values):
@@ -14,22 +15,56 @@ def find_closest(value, values):
     return found
 
 
-def main():
-    PIECES = 100
-    PRECISION = 10000
-    MAXIMUM = 10000
+PIECES = 100
+PRECISION = 10000
+MAXIMUM = 10000
+
 
+def table():
+    """
+    Phase delay (out of MAXIMUM) that delivers each power percentage of a sine half wave,
+    plus the 100% endpoint used for interpolation
+    """
     xs = [(x * 3.14)/PRECISION for x in range(PRECISION)]
     values = [((math.cos(0) - math.cos(x)) * 100) / 2. for x in xs[::-1]]
 
-    print(
-        f"static const uint16_t sine_percentage_linearization[{PIECES}] = {{")
+    result = []
     for i in range(PIECES):
         perc = i * (100/PIECES)
         approx = values.index(find_closest(perc, values)) * (100/PRECISION)
         approx = approx * MAXIMUM / PIECES
-        print(f"    {int(approx)},")
-    print("};")
+        result.append(int(approx))
+    result.append(0)
+    return result
+
+
+def header():
+    lines = [
+        "#ifndef SINE_LINEARIZATION_H_INCLUDED",
+        "#define SINE_LINEARIZATION_H_INCLUDED",
+        "",
+        "// Generated by tools/sine_percentage_linearization.py, do not edit",
+        "",
+        "#include <stdint.h>",
+        "",
+        "",
+        f"#define SINE_PERCENTAGE_LINEARIZATION_PIECES  {PIECES}",
+        f"#define SINE_PERCENTAGE_LINEARIZATION_MAXIMUM {MAXIMUM}",
+        "",
+        "",
+        "static const uint16_t sine_percentage_linearization[SINE_PERCENTAGE_LINEARIZATION_PIECES + 1] = {",
+    ]
+    lines += [f"    {value}," for value in table()]
+    lines += ["};", "", "", "#endif"]
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], "w") as f:
+            f.write(header())
+    else:
+        print(header(), end="")
 
 
 if __name__ == "__main__":